@@ -12,6 +12,7 @@
 #include <stdint.h>
 #include <assert.h>
 #include <string.h>
+#include <limits.h>
 
 #define TYPE_NIL 0
 #define TYPE_BOOLEAN 1
@@ -30,89 +31,148 @@
 // hibits 0~31 : len
 #define TYPE_LONG_STRING 5
 #define TYPE_TABLE 6
+#define TYPE_TABLE_SHAPE 7
+// hibits : array size as TYPE_TABLE, then the shape id (integer).
+// A new shape id is followed by the keys (integer n, n strings), see packdict.
+// Then the array part and the values of the keys.
 
 #define MAX_COOKIE 32
 #define COMBINE_TYPE(t,v) ((t) | (v) << 3)
 
-#define BLOCK_SIZE 128
 #define MAX_DEPTH 32
 
-struct block {
-	struct block * next;
-	char buffer[BLOCK_SIZE];
+// packdict : the string keys of the tables, packed once per message
+#define MAX_SHAPE 64
+#define MAX_SHAPE_KEY 32
+#define MAX_SHAPE_POOL 1024
+
+// the write buffer of a lua state is reused, unless it grows larger than this
+#define BUFFER_INIT 1024
+#define BUFFER_KEEP 0x10000
+
+struct shape {
+	uint32_t hash;
+	int n;
+	int key;	// the first key in dict->key
+};
+
+struct shape_dict {
+	int n;
+	int nkey;
+	struct shape shape[MAX_SHAPE];
+	const char * key[MAX_SHAPE_POOL];
 };
 
 struct write_block {
-	struct block * head;
-	struct block * current;
+	char * buffer;
+	int cap;
 	int len;
-	int ptr;
+	struct shape_dict * dict;	// NULL : pack
+};
+
+// unpack_lazy : the copy of the message, and where the shapes are defined
+struct lazy_shape {
+	int n;
+	int def;	// the definition (integer n) in the buffer
+	int key;	// the first key
+};
+
+struct lazy_buffer {
+	int sz;
+	int n;	// the number of the values
+	int nshape;
+	struct lazy_shape shape[MAX_SHAPE];
+	char buffer[1];
 };
 
 struct read_block {
 	char * buffer;
 	int len;
 	int ptr;
+	int shapes;	// the stack index of the key tables of TYPE_TABLE_SHAPE
+	int nshape;
+	struct lazy_buffer * lazy;	// the shapes of unpack_lazy (instead of shapes)
 };
 
-inline static struct block *
-blk_alloc(void) {
-	struct block *b = skynet_malloc(sizeof(struct block));
-	b->next = NULL;
-	return b;
+static void
+wb_grow(struct write_block *b, int sz) {
+	int cap = b->cap * 2;
+	if (cap < BUFFER_INIT)
+		cap = BUFFER_INIT;
+	while (cap < b->len + sz)
+		cap *= 2;
+	b->buffer = skynet_realloc(b->buffer, cap);
+	b->cap = cap;
 }
 
 inline static void
 wb_push(struct write_block *b, const void *buf, int sz) {
-	const char * buffer = buf;
-	if (b->ptr == BLOCK_SIZE) {
-_again:
-		b->current = b->current->next = blk_alloc();
-		b->ptr = 0;
-	}
-	if (b->ptr <= BLOCK_SIZE - sz) {
-		memcpy(b->current->buffer + b->ptr, buffer, sz);
-		b->ptr+=sz;
-		b->len+=sz;
-	} else {
-		int copy = BLOCK_SIZE - b->ptr;
-		memcpy(b->current->buffer + b->ptr, buffer, copy);
-		buffer += copy;
-		b->len += copy;
-		sz -= copy;
-		goto _again;
+	if (b->len + sz > b->cap) {
+		wb_grow(b, sz);
 	}
+	memcpy(b->buffer + b->len, buf, sz);
+	b->len += sz;
 }
 
-static void
-wb_init(struct write_block *wb , struct block *b) {
-	wb->head = b;
-	assert(b->next == NULL);
+static int
+wb_gc(lua_State *L) {
+	struct write_block *wb = lua_touserdata(L, 1);
+	skynet_free(wb->buffer);
+	wb->buffer = NULL;
+	wb->cap = 0;
+	return 0;
+}
+
+static int WRITE_BLOCK = 0;
+
+/*
+	The write buffer is kept in the registry of the lua state (the service), and it's taken away during packing.
+	So a nested pack (from __pairs, or __gc) uses a new one, and the buffer is collected by gc when pack raises an error.
+ */
+static struct write_block *
+wb_init(lua_State *L) {
+	struct write_block *wb;
+	if (lua_rawgetp(L, LUA_REGISTRYINDEX, &WRITE_BLOCK) == LUA_TUSERDATA) {
+		wb = lua_touserdata(L, -1);
+		lua_pushnil(L);
+		lua_rawsetp(L, LUA_REGISTRYINDEX, &WRITE_BLOCK);
+	} else {
+		lua_pop(L, 1);
+		wb = lua_newuserdata(L, sizeof(*wb));
+		wb->buffer = NULL;
+		wb->cap = 0;
+		if (luaL_newmetatable(L, "SKYNET_SERI_BUFFER")) {
+			lua_pushcfunction(L, wb_gc);
+			lua_setfield(L, -2, "__gc");
+		}
+		lua_setmetatable(L, -2);
+	}
 	wb->len = 0;
-	wb->current = wb->head;
-	wb->ptr = 0;
+	wb->dict = NULL;
+	return wb;
 }
 
+// put the write buffer (at index) back
 static void
-wb_free(struct write_block *wb) {
-	struct block *blk = wb->head;
-	blk = blk->next;	// the first block is on stack
-	while (blk) {
-		struct block * next = blk->next;
-		skynet_free(blk);
-		blk = next;
-	}
-	wb->head = NULL;
-	wb->current = NULL;
-	wb->ptr = 0;
-	wb->len = 0;
+wb_release(lua_State *L, struct write_block *wb, int index) {
+	if (wb->cap > BUFFER_KEEP) {
+		skynet_free(wb->buffer);
+		wb->buffer = NULL;
+		wb->cap = 0;
+	}
+	wb->dict = NULL;
+	lua_pushvalue(L, index);
+	lua_rawsetp(L, LUA_REGISTRYINDEX, &WRITE_BLOCK);
 }
 
 static void
-rball_init(struct read_block * rb, char * buffer, int size) {
+rball_init(struct read_block * rb, char * buffer, int size, int shapes) {
 	rb->buffer = buffer;
 	rb->len = size;
 	rb->ptr = 0;
+	rb->shapes = shapes;
+	rb->nshape = 0;
+	rb->lazy = NULL;
 }
 
 static void *
@@ -214,40 +274,44 @@ wb_string(struct write_block *wb, const char *str, int len) {
 
 static void pack_one(lua_State *L, struct write_block *b, int index, int depth);
 
-static int
-wb_table_array(lua_State *L, struct write_block * wb, int index, int depth) {
-	int array_size = lua_rawlen(L,index);
+static void
+wb_table_size(struct write_block *wb, int type, int array_size) {
 	if (array_size >= MAX_COOKIE-1) {
-		uint8_t n = COMBINE_TYPE(TYPE_TABLE, MAX_COOKIE-1);
+		uint8_t n = COMBINE_TYPE(type, MAX_COOKIE-1);
 		wb_push(wb, &n, 1);
 		wb_integer(wb, array_size);
 	} else {
-		uint8_t n = COMBINE_TYPE(TYPE_TABLE, array_size);
+		uint8_t n = COMBINE_TYPE(type, array_size);
 		wb_push(wb, &n, 1);
 	}
+}
 
+static void
+wb_table_array(lua_State *L, struct write_block * wb, int index, int depth, int array_size) {
 	int i;
 	for (i=1;i<=array_size;i++) {
 		lua_rawgeti(L,index,i);
 		pack_one(L, wb, -1, depth);
 		lua_pop(L,1);
 	}
+}
 
-	return array_size;
+static inline int
+array_key(lua_State *L, int index, int array_size) {
+	if (lua_isinteger(L, index)) {
+		lua_Integer x = lua_tointeger(L, index);
+		return x>0 && x<=array_size;
+	}
+	return 0;
 }
 
 static void
 wb_table_hash(lua_State *L, struct write_block * wb, int index, int depth, int array_size) {
 	lua_pushnil(L);
 	while (lua_next(L, index) != 0) {
-		if (lua_type(L,-2) == LUA_TNUMBER) {
-			if (lua_isinteger(L, -2)) {
-				lua_Integer x = lua_tointeger(L,-2);
-				if (x>0 && x<=array_size) {
-					lua_pop(L,1);
-					continue;
-				}
-			}
+		if (lua_type(L,-2) == LUA_TNUMBER && array_key(L, -2, array_size)) {
+			lua_pop(L,1);
+			continue;
 		}
 		pack_one(L,wb,-2,depth);
 		pack_one(L,wb,-1,depth);
@@ -256,8 +320,96 @@ wb_table_hash(lua_State *L, struct write_block * wb, int index, int depth, int a
 	wb_nil(wb);
 }
 
+// returns the shape id of the table, and sets *define for a new shape. -1 : the table can't be packed as a shape
+static int
+shape_find(lua_State *L, struct shape_dict *dict, int index, int array_size, const char **key, size_t *len, int *n, int *define) {
+	int nkey = 0;
+	uint32_t h = 0;
+	lua_pushnil(L);
+	while (lua_next(L, index) != 0) {
+		lua_pop(L, 1);
+		int type = lua_type(L, -1);
+		if (type == LUA_TNUMBER && array_key(L, -1, array_size)) {
+			continue;
+		}
+		if (type != LUA_TSTRING || nkey >= MAX_SHAPE_KEY) {
+			lua_pop(L, 1);
+			return -1;
+		}
+		// the keys of the tables are alive during packing, so the same key (interned or not) has the same address.
+		key[nkey] = lua_tolstring(L, -1, &len[nkey]);
+		h = h * 31 + (uint32_t)((uintptr_t)key[nkey] >> 3);
+		++nkey;
+	}
+	if (nkey == 0) {
+		return -1;
+	}
+	*n = nkey;
+	int i;
+	for (i=0;i<dict->n;i++) {
+		struct shape *s = &dict->shape[i];
+		if (s->hash == h && s->n == nkey && memcmp(&dict->key[s->key], key, nkey * sizeof(key[0])) == 0) {
+			*define = 0;
+			return i;
+		}
+	}
+	if (dict->n >= MAX_SHAPE || dict->nkey + nkey > MAX_SHAPE_POOL) {
+		return -1;
+	}
+	struct shape *s = &dict->shape[dict->n];
+	s->hash = h;
+	s->n = nkey;
+	s->key = dict->nkey;
+	memcpy(&dict->key[dict->nkey], key, nkey * sizeof(key[0]));
+	dict->nkey += nkey;
+	*define = 1;
+	return dict->n++;
+}
+
+static int
+wb_table_shape(lua_State *L, struct write_block *wb, int index, int depth, int array_size) {
+	const char * key[MAX_SHAPE_KEY];
+	size_t len[MAX_SHAPE_KEY];
+	int n = 0;
+	int define = 0;
+	int id = shape_find(L, wb->dict, index, array_size, key, len, &n, &define);
+	if (id < 0) {
+		return 0;
+	}
+	wb_table_size(wb, TYPE_TABLE_SHAPE, array_size);
+	wb_integer(wb, id);
+	int i;
+	if (define) {
+		wb_integer(wb, n);
+		for (i=0;i<n;i++) {
+			wb_string(wb, key[i], (int)len[i]);
+		}
+	}
+	wb_table_array(L, wb, index, depth, array_size);
+	// the same order as shape_find
+	i = 0;
+	lua_pushnil(L);
+	while (lua_next(L, index) != 0) {
+		if (lua_type(L,-2) == LUA_TNUMBER && array_key(L, -2, array_size)) {
+			lua_pop(L,1);
+			continue;
+		}
+		if (++i > n) {
+			luaL_error(L, "serialize table is changed during packing");
+		}
+		pack_one(L,wb,-1,depth);
+		lua_pop(L, 1);
+	}
+	if (i != n) {
+		luaL_error(L, "serialize table is changed during packing");
+	}
+	return 1;
+}
+
 static void
 wb_table_metapairs(lua_State *L, struct write_block *wb, int index, int depth) {
+	// __pairs may drop the keys in the dictionary
+	wb->dict = NULL;
 	uint8_t n = COMBINE_TYPE(TYPE_TABLE, 0);
 	wb_push(wb, &n, 1);
 	lua_pushvalue(L, index);
@@ -288,7 +440,12 @@ wb_table(lua_State *L, struct write_block *wb, int index, int depth) {
 	if (luaL_getmetafield(L, index, "__pairs") != LUA_TNIL) {
 		wb_table_metapairs(L, wb, index, depth);
 	} else {
-		int array_size = wb_table_array(L, wb, index, depth);
+		int array_size = lua_rawlen(L,index);
+		if (wb->dict && wb_table_shape(L, wb, index, depth, array_size)) {
+			return;
+		}
+		wb_table_size(wb, TYPE_TABLE, array_size);
+		wb_table_array(L, wb, index, depth, array_size);
 		wb_table_hash(L, wb, index, depth, array_size);
 	}
 }
@@ -296,7 +453,6 @@ wb_table(lua_State *L, struct write_block *wb, int index, int depth) {
 static void
 pack_one(lua_State *L, struct write_block *b, int index, int depth) {
 	if (depth > MAX_DEPTH) {
-		wb_free(b);
 		luaL_error(L, "serialize can't pack too depth table");
 	}
 	int type = lua_type(L,index);
@@ -334,17 +490,15 @@ pack_one(lua_State *L, struct write_block *b, int index, int depth) {
 		break;
 	}
 	default:
-		wb_free(b);
 		luaL_error(L, "Unsupport type %s to serialize", lua_typename(L, type));
 	}
 }
 
 static void
-pack_from(lua_State *L, struct write_block *b, int from) {
-	int n = lua_gettop(L) - from;
+pack_from(lua_State *L, struct write_block *b, int n) {
 	int i;
 	for (i=1;i<=n;i++) {
-		pack_one(L, b , from + i, 0);
+		pack_one(L, b , i, 0);
 	}
 }
 
@@ -431,8 +585,8 @@ get_buffer(lua_State *L, struct read_block *rb, int len) {
 
 static void unpack_one(lua_State *L, struct read_block *rb);
 
-static void
-unpack_table(lua_State *L, struct read_block *rb, int array_size) {
+static int
+get_array_size(lua_State *L, struct read_block *rb, int array_size) {
 	if (array_size == MAX_COOKIE-1) {
 		uint8_t type;
 		uint8_t *t = rb_read(rb, sizeof(type));
@@ -446,13 +600,24 @@ unpack_table(lua_State *L, struct read_block *rb, int array_size) {
 		}
 		array_size = get_integer(L,rb,cookie);
 	}
-	luaL_checkstack(L,LUA_MINSTACK,NULL);
-	lua_createtable(L,array_size,0);
+	return array_size;
+}
+
+static void
+unpack_array(lua_State *L, struct read_block *rb, int array_size) {
 	int i;
 	for (i=1;i<=array_size;i++) {
 		unpack_one(L,rb);
 		lua_rawseti(L,-2,i);
 	}
+}
+
+static void
+unpack_table(lua_State *L, struct read_block *rb, int array_size) {
+	array_size = get_array_size(L, rb, array_size);
+	luaL_checkstack(L,LUA_MINSTACK,NULL);
+	lua_createtable(L,array_size,0);
+	unpack_array(L, rb, array_size);
 	for (;;) {
 		unpack_one(L,rb);
 		if (lua_isnil(L,-1)) {
@@ -464,6 +629,93 @@ unpack_table(lua_State *L, struct read_block *rb, int array_size) {
 	}
 }
 
+static int
+get_small_integer(lua_State *L, struct read_block *rb, int max) {
+	uint8_t *t = rb_read(rb, sizeof(uint8_t));
+	if (t==NULL) {
+		invalid_stream(L,rb);
+	}
+	uint8_t type = *t;
+	int cookie = type >> 3;
+	if ((type & 7) != TYPE_NUMBER || cookie == TYPE_NUMBER_REAL) {
+		invalid_stream(L,rb);
+	}
+	lua_Integer v = get_integer(L,rb,cookie);
+	if (v < 0 || v > max) {
+		invalid_stream(L,rb);
+	}
+	return (int)v;
+}
+
+static void skip_keys(lua_State *L, struct read_block *rb, struct lazy_shape *s);
+
+static void
+unpack_shape_lazy(lua_State *L, struct read_block *rb, int array_size) {
+	struct lazy_buffer *lb = rb->lazy;
+	int id = get_small_integer(L, rb, lb->nshape - 1);
+	struct lazy_shape *s = &lb->shape[id];
+	if (s->def == rb->ptr) {
+		skip_keys(L, rb, s);
+	}
+	lua_createtable(L,array_size,s->n);
+	unpack_array(L, rb, array_size);
+	struct read_block keys;
+	rball_init(&keys, lb->buffer, lb->sz, 0);
+	keys.ptr = s->key;
+	keys.len = lb->sz - s->key;
+	int i;
+	for (i=0;i<s->n;i++) {
+		unpack_one(L,&keys);
+		unpack_one(L,rb);
+		lua_rawset(L,-3);
+	}
+}
+
+static void
+unpack_shape(lua_State *L, struct read_block *rb, int array_size) {
+	array_size = get_array_size(L, rb, array_size);
+	luaL_checkstack(L,LUA_MINSTACK,NULL);
+	if (rb->lazy) {
+		unpack_shape_lazy(L, rb, array_size);
+		return;
+	}
+	int id = get_small_integer(L, rb, rb->nshape);
+	int n;
+	if (id == rb->nshape) {
+		// a new shape, the keys follow
+		n = get_small_integer(L, rb, MAX_SHAPE_KEY);
+		if (id == 0) {
+			lua_createtable(L, MAX_SHAPE, 0);
+			lua_replace(L, rb->shapes);
+		}
+		lua_createtable(L, n, 0);
+		int i;
+		for (i=1;i<=n;i++) {
+			unpack_one(L,rb);
+			if (lua_type(L,-1) != LUA_TSTRING) {
+				invalid_stream(L,rb);
+			}
+			lua_rawseti(L,-2,i);
+		}
+		lua_pushvalue(L,-1);
+		lua_rawseti(L,rb->shapes,id+1);
+		++rb->nshape;
+	} else {
+		lua_rawgeti(L,rb->shapes,id+1);
+		n = lua_rawlen(L,-1);
+	}
+	lua_createtable(L,array_size,n);
+	unpack_array(L, rb, array_size);
+	int i;
+	for (i=1;i<=n;i++) {
+		lua_rawgeti(L,-2,i);
+		unpack_one(L,rb);
+		lua_rawset(L,-3);
+	}
+	// remove the keys
+	lua_remove(L,-2);
+}
+
 static void
 push_value(lua_State *L, struct read_block *rb, int type, int cookie) {
 	switch(type) {
@@ -513,6 +765,10 @@ push_value(lua_State *L, struct read_block *rb, int type, int cookie) {
 		unpack_table(L,rb,cookie);
 		break;
 	}
+	case TYPE_TABLE_SHAPE: {
+		unpack_shape(L,rb,cookie);
+		break;
+	}
 	default: {
 		invalid_stream(L,rb);
 		break;
@@ -531,29 +787,8 @@ unpack_one(lua_State *L, struct read_block *rb) {
 	push_value(L, rb, type & 0x7, type>>3);
 }
 
-static void
-seri(lua_State *L, struct block *b, int len) {
-	uint8_t * buffer = skynet_malloc(len);
-	uint8_t * ptr = buffer;
-	int sz = len;
-	while(len>0) {
-		if (len >= BLOCK_SIZE) {
-			memcpy(ptr, b->buffer, BLOCK_SIZE);
-			ptr += BLOCK_SIZE;
-			len -= BLOCK_SIZE;
-			b = b->next;
-		} else {
-			memcpy(ptr, b->buffer, len);
-			break;
-		}
-	}
-	
-	lua_pushlightuserdata(L, buffer);
-	lua_pushinteger(L, sz);
-}
-
-int
-luaseri_unpack(lua_State *L) {
+static int
+unpack_values(lua_State *L, int max) {
 	if (lua_isnoneornil(L,1)) {
 		return 0;
 	}
@@ -575,11 +810,12 @@ luaseri_unpack(lua_State *L) {
 	}
 
 	lua_settop(L,1);
+	lua_pushnil(L);	// the key tables of the shapes
 	struct read_block rb;
-	rball_init(&rb, buffer, len);
+	rball_init(&rb, buffer, len, 2);
 
 	int i;
-	for (i=0;;i++) {
+	for (i=0;i<max;i++) {
 		if (i%8==7) {
 			luaL_checkstack(L,LUA_MINSTACK,NULL);
 		}
@@ -593,20 +829,412 @@ luaseri_unpack(lua_State *L) {
 
 	// Need not free buffer
 
-	return lua_gettop(L) - 1;
+	return lua_gettop(L) - 2;
 }
 
-LUAMOD_API int
-luaseri_pack(lua_State *L) {
-	struct block temp;
-	temp.next = NULL;
-	struct write_block wb;
-	wb_init(&wb, &temp);
-	pack_from(L,&wb,0);
-	assert(wb.head == &temp);
-	seri(L, &temp, wb.len);
+int
+luaseri_unpack(lua_State *L) {
+	return unpack_values(L, INT_MAX);
+}
 
-	wb_free(&wb);
+// msg, sz, n : unpack the first n values only (sz is ignored if msg is a string)
+int
+luaseri_peek(lua_State *L) {
+	int n = luaL_checkinteger(L, 3);
+	lua_settop(L, 2);
+	return unpack_values(L, n);
+}
 
+/*
+	unpack_lazy copies the message into a userdata (so it can be kept after the message is freed),
+	and returns a proxy of the values. The tables in it are proxies too, and a field is unpacked
+	when it's read (__index). #proxy is the size of the array part (or the number of the values),
+	and pairs(proxy) unpacks the whole table.
+ */
+
+static void skip_one(lua_State *L, struct read_block *rb);
+
+static const char *
+get_string(lua_State *L, struct read_block *rb, int type, int cookie, size_t *sz) {
+	int len;
+	if (type == TYPE_SHORT_STRING) {
+		len = cookie;
+	} else if (type == TYPE_LONG_STRING && cookie == 2) {
+		uint16_t n;
+		uint16_t *plen = rb_read(rb, 2);
+		if (plen == NULL)
+			invalid_stream(L,rb);
+		memcpy(&n, plen, sizeof(n));
+		len = n;
+	} else if (type == TYPE_LONG_STRING && cookie == 4) {
+		uint32_t n;
+		uint32_t *plen = rb_read(rb, 4);
+		if (plen == NULL)
+			invalid_stream(L,rb);
+		memcpy(&n, plen, sizeof(n));
+		len = (int)n;
+	} else {
+		invalid_stream(L,rb);
+		return NULL;
+	}
+	const char * str = rb_read(rb, len);
+	if (str == NULL)
+		invalid_stream(L,rb);
+	*sz = len;
+	return str;
+}
+
+static inline int
+read_type(lua_State *L, struct read_block *rb) {
+	uint8_t *t = rb_read(rb, sizeof(uint8_t));
+	if (t==NULL)
+		invalid_stream(L,rb);
+	return *t;
+}
+
+static inline int
+peek_type(struct read_block *rb) {
+	if (rb->len < 1)
+		return -1;
+	return (uint8_t)rb->buffer[rb->ptr];
+}
+
+// skip the definition of the shape
+static void
+skip_keys(lua_State *L, struct read_block *rb, struct lazy_shape *s) {
+	s->n = get_small_integer(L, rb, MAX_SHAPE_KEY);
+	s->key = rb->ptr;
+	int i;
+	for (i=0;i<s->n;i++) {
+		int type = read_type(L, rb);
+		size_t sz;
+		get_string(L, rb, type & 0x7, type >> 3, &sz);
+	}
+}
+
+static void
+skip_shape(lua_State *L, struct read_block *rb, int array_size) {
+	struct lazy_buffer *lb = rb->lazy;
+	int id = get_small_integer(L, rb, lb->nshape);
+	struct lazy_shape *s = &lb->shape[id];
+	if (id == lb->nshape) {
+		// the first pass (luaseri_lazy) finds the shapes
+		if (id >= MAX_SHAPE)
+			invalid_stream(L,rb);
+		s->def = rb->ptr;
+		++lb->nshape;
+	}
+	if (s->def == rb->ptr) {
+		skip_keys(L, rb, s);
+	}
+	int i;
+	for (i=0;i<array_size + s->n;i++) {
+		skip_one(L, rb);
+	}
+}
+
+static void
+skip_one(lua_State *L, struct read_block *rb) {
+	int type = read_type(L, rb);
+	int cookie = type >> 3;
+	switch (type & 0x7) {
+	case TYPE_NIL:
+	case TYPE_BOOLEAN:
+		break;
+	case TYPE_NUMBER:
+		if (cookie == TYPE_NUMBER_REAL) {
+			get_real(L, rb);
+		} else {
+			get_integer(L, rb, cookie);
+		}
+		break;
+	case TYPE_USERDATA:
+		get_pointer(L, rb);
+		break;
+	case TYPE_SHORT_STRING:
+	case TYPE_LONG_STRING: {
+		size_t sz;
+		get_string(L, rb, type & 0x7, cookie, &sz);
+		break;
+	}
+	case TYPE_TABLE: {
+		int array_size = get_array_size(L, rb, cookie);
+		int i;
+		for (i=0;i<array_size;i++) {
+			skip_one(L, rb);
+		}
+		for (;;) {
+			if (peek_type(rb) == TYPE_NIL) {
+				rb_read(rb, 1);
+				break;
+			}
+			skip_one(L, rb);
+			skip_one(L, rb);
+		}
+		break;
+	}
+	case TYPE_TABLE_SHAPE:
+		skip_shape(L, rb, get_array_size(L, rb, cookie));
+		break;
+	}
+}
+
+#define LAZY_TABLE "SKYNET_SERI_LAZY"
+
+struct lazy_table {
+	int offset;	// the table in the buffer, -1 : the values of the message
+};
+
+static void
+lazy_new(lua_State *L, int buffer, int offset) {
+	struct lazy_table *t = lua_newuserdata(L, sizeof(*t));
+	t->offset = offset;
+	luaL_setmetatable(L, LAZY_TABLE);
+	lua_pushvalue(L, buffer);
+	lua_setuservalue(L, -2);
+}
+
+// push the value at rb, a table is a proxy
+static void
+lazy_value(lua_State *L, int buffer, struct read_block *rb) {
+	int type = peek_type(rb) & 0x7;
+	if (type == TYPE_TABLE || type == TYPE_TABLE_SHAPE) {
+		lazy_new(L, buffer, rb->ptr);
+	} else {
+		unpack_one(L, rb);
+	}
+}
+
+// open the table, returns the array size and the shape (-1 : TYPE_TABLE), rb is at the array part
+static int
+lazy_open(lua_State *L, struct lazy_buffer *lb, int offset, struct read_block *rb, int *shape) {
+	rball_init(rb, lb->buffer, lb->sz, 0);
+	rb->lazy = lb;
+	*shape = -1;
+	if (offset < 0) {
+		return lb->n;
+	}
+	rb->ptr = offset;
+	rb->len = lb->sz - offset;
+	int type = read_type(L, rb);
+	int array_size = get_array_size(L, rb, type >> 3);
+	if ((type & 0x7) == TYPE_TABLE_SHAPE) {
+		int id = get_small_integer(L, rb, lb->nshape - 1);
+		if (lb->shape[id].def == rb->ptr) {
+			skip_keys(L, rb, &lb->shape[id]);
+		}
+		*shape = id;
+	}
+	return array_size;
+}
+
+static struct lazy_buffer *
+lazy_self(lua_State *L, struct lazy_table **t) {
+	*t = luaL_checkudata(L, 1, LAZY_TABLE);
+	lua_settop(L, 2);
+	lua_getuservalue(L, 1);
+	return lua_touserdata(L, 3);
+}
+
+static int
+llazy_index(lua_State *L) {
+	struct lazy_table *t;
+	struct lazy_buffer *lb = lazy_self(L, &t);
+	struct read_block rb;
+	int shape;
+	int array_size = lazy_open(L, lb, t->offset, &rb, &shape);
+	int i;
+	if (lua_isinteger(L, 2)) {
+		lua_Integer k = lua_tointeger(L, 2);
+		if (k > 0 && k <= array_size) {
+			for (i=1;i<k;i++) {
+				skip_one(L, &rb);
+			}
+			lazy_value(L, 3, &rb);
+			return 1;
+		}
+	}
+	if (t->offset < 0) {
+		return 0;
+	}
+	for (i=0;i<array_size;i++) {
+		skip_one(L, &rb);
+	}
+	size_t sz = 0;
+	const char * key = NULL;
+	if (lua_type(L, 2) == LUA_TSTRING) {
+		key = lua_tolstring(L, 2, &sz);
+	}
+	if (shape >= 0) {
+		if (key == NULL) {
+			return 0;
+		}
+		struct lazy_shape *s = &lb->shape[shape];
+		struct read_block keys = rb;
+		keys.ptr = s->key;
+		keys.len = lb->sz - s->key;
+		for (i=0;i<s->n;i++) {
+			int type = read_type(L, &keys);
+			size_t len;
+			const char * str = get_string(L, &keys, type & 0x7, type >> 3, &len);
+			if (len == sz && memcmp(str, key, sz) == 0) {
+				lazy_value(L, 3, &rb);
+				return 1;
+			}
+			skip_one(L, &rb);
+		}
+		return 0;
+	}
+	for (;;) {
+		int type = peek_type(&rb);
+		if (type == TYPE_NIL) {
+			return 0;
+		}
+		int found;
+		switch (type & 0x7) {
+		case TYPE_SHORT_STRING:
+		case TYPE_LONG_STRING: {
+			rb_read(&rb, 1);
+			size_t len;
+			const char * str = get_string(L, &rb, type & 0x7, type >> 3, &len);
+			found = key && len == sz && memcmp(str, key, sz) == 0;
+			break;
+		}
+		case TYPE_TABLE:
+		case TYPE_TABLE_SHAPE:
+			skip_one(L, &rb);
+			found = 0;
+			break;
+		default:
+			unpack_one(L, &rb);
+			found = lua_rawequal(L, -1, 2);
+			lua_pop(L, 1);
+			break;
+		}
+		if (found) {
+			lazy_value(L, 3, &rb);
+			return 1;
+		}
+		skip_one(L, &rb);
+	}
+}
+
+static int
+llazy_len(lua_State *L) {
+	struct lazy_table *t;
+	struct lazy_buffer *lb = lazy_self(L, &t);
+	struct read_block rb;
+	int shape;
+	lua_pushinteger(L, lazy_open(L, lb, t->offset, &rb, &shape));
+	return 1;
+}
+
+static int
+llazy_next(lua_State *L) {
+	luaL_checktype(L, 1, LUA_TTABLE);
+	lua_settop(L, 2);
+	if (lua_next(L, 1)) {
+		return 2;
+	}
+	lua_pushnil(L);
+	return 1;
+}
+
+static int
+llazy_pairs(lua_State *L) {
+	struct lazy_table *t;
+	struct lazy_buffer *lb = lazy_self(L, &t);
+	struct read_block rb;
+	rball_init(&rb, lb->buffer, lb->sz, 0);
+	rb.lazy = lb;
+	lua_pushcfunction(L, llazy_next);
+	if (t->offset < 0) {
+		lua_createtable(L, lb->n, 0);
+		unpack_array(L, &rb, lb->n);
+	} else {
+		rb.ptr = t->offset;
+		rb.len = lb->sz - t->offset;
+		unpack_one(L, &rb);
+	}
+	lua_pushnil(L);
+	return 3;
+}
+
+int
+luaseri_lazy(lua_State *L) {
+	void * buffer = NULL;
+	int len = 0;
+	if (lua_type(L,1) == LUA_TSTRING) {
+		size_t sz;
+		buffer = (void *)lua_tolstring(L,1,&sz);
+		len = (int)sz;
+	} else if (!lua_isnoneornil(L,1)) {
+		buffer = lua_touserdata(L,1);
+		len = luaL_checkinteger(L,2);
+		if (buffer == NULL && len > 0) {
+			return luaL_error(L, "deserialize null pointer");
+		}
+	}
+	lua_settop(L, 0);
+	struct lazy_buffer *lb = lua_newuserdata(L, sizeof(*lb) + len);
+	lb->sz = len;
+	lb->n = 0;
+	lb->nshape = 0;
+	if (len > 0) {
+		memcpy(lb->buffer, buffer, len);
+	}
+	// check the message, and find the shapes
+	struct read_block rb;
+	rball_init(&rb, lb->buffer, len, 0);
+	rb.lazy = lb;
+	while (rb.len > 0) {
+		skip_one(L, &rb);
+		++lb->n;
+	}
+	if (luaL_newmetatable(L, LAZY_TABLE)) {
+		luaL_Reg l[] = {
+			{ "__index", llazy_index },
+			{ "__len", llazy_len },
+			{ "__pairs", llazy_pairs },
+			{ NULL, NULL },
+		};
+		luaL_setfuncs(L, l, 0);
+	}
+	lua_pop(L, 1);
+	lazy_new(L, 1, -1);
+	return 1;
+}
+
+static int
+pack(lua_State *L, struct shape_dict *dict) {
+	int n = lua_gettop(L);
+	struct write_block *wb = wb_init(L);
+	wb->dict = dict;
+	pack_from(L, wb, n);
+	// the final allocation is the only one, unless the write buffer grows.
+	uint8_t * buffer = skynet_malloc(wb->len);
+	memcpy(buffer, wb->buffer, wb->len);
+	int sz = wb->len;
+	wb_release(L, wb, n+1);
+
+	lua_pushlightuserdata(L, buffer);
+	lua_pushinteger(L, sz);
 	return 2;
 }
+
+LUAMOD_API int
+luaseri_pack(lua_State *L) {
+	return pack(L, NULL);
+}
+
+/*
+	The same as luaseri_pack, but the string keys of each table shape (the same keys in the same order,
+	such as the records of an array) are packed once per message. luaseri_unpack reads both.
+ */
+LUAMOD_API int
+luaseri_packdict(lua_State *L) {
+	struct shape_dict dict;
+	dict.n = 0;
+	dict.nkey = 0;
+	return pack(L, &dict);
+}
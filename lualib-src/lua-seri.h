@@ -4,6 +4,9 @@
 #include <lua.h>
 
 int luaseri_pack(lua_State *L);
+int luaseri_packdict(lua_State *L);
 int luaseri_unpack(lua_State *L);
+int luaseri_peek(lua_State *L);
+int luaseri_lazy(lua_State *L);
 
 #endif
@@ -321,6 +321,88 @@ lredirect(lua_State *L) {
 	return send_message(L, source, 3);
 }
 
+#define FANOUT_STACK 64
+
+/*
+	table addresses (uint32 address or string address array)
+	integer type
+	string message
+	 lightuserdata message_ptr
+	 integer len
+
+	The message is sent to all the addresses without copying, returns the number of failures.
+	A string address is ":hex" or ".localname", a name not found is a failure.
+ */
+static int
+lfanout(lua_State *L) {
+	struct skynet_context * context = lua_touserdata(L, lua_upvalueindex(1));
+	// take the message first, it's freed when the other arguments are invalid.
+	void * msg;
+	size_t sz;
+	int isnum;
+	switch (lua_type(L, 3)) {
+	case LUA_TSTRING: {
+		const char * str = lua_tolstring(L, 3, &sz);
+		msg = skynet_malloc(sz);
+		memcpy(msg, str, sz);
+		break;
+	}
+	case LUA_TLIGHTUSERDATA:
+		msg = lua_touserdata(L, 3);
+		sz = (size_t)lua_tointegerx(L, 4, &isnum);
+		if (!isnum) {
+			skynet_free(msg);
+			return luaL_error(L, "Invalid message size (%s)", lua_typename(L, lua_type(L,4)));
+		}
+		break;
+	default:
+		return luaL_error(L, "invalid param %s", lua_typename(L, lua_type(L,3)));
+	}
+	int type = (int)lua_tointegerx(L, 2, &isnum);
+	if (!isnum || lua_type(L, 1) != LUA_TTABLE) {
+		skynet_free(msg);
+		return luaL_error(L, "Need an address table and a type");
+	}
+	int n = lua_rawlen(L, 1);
+	uint32_t tmp[FANOUT_STACK];
+	uint32_t *dest = tmp;
+	if (n > FANOUT_STACK) {
+		dest = skynet_malloc(n * sizeof(uint32_t));
+	}
+	int i;
+	int m = 0;
+	int err = 0;
+	for (i=0;i<n;i++) {
+		uint32_t addr = 0;
+		int t = lua_rawgeti(L, 1, i+1);
+		if (t == LUA_TNUMBER) {
+			addr = (uint32_t)lua_tointeger(L, -1);
+		} else if (t == LUA_TSTRING) {
+			addr = skynet_queryname(context, lua_tostring(L, -1));
+			if (addr == 0) {
+				++err;
+				lua_pop(L, 1);
+				continue;
+			}
+		}
+		lua_pop(L, 1);
+		if (addr == 0) {
+			skynet_free(msg);
+			if (dest != tmp) {
+				skynet_free(dest);
+			}
+			return luaL_error(L, "Invalid service address at [%d]", i+1);
+		}
+		dest[m++] = addr;
+	}
+	err += skynet_send_shared(context, 0, dest, m, type, msg, sz);
+	if (dest != tmp) {
+		skynet_free(dest);
+	}
+	lua_pushinteger(L, err);
+	return 1;
+}
+
 static int
 lerror(lua_State *L) {
 	struct skynet_context * context = lua_touserdata(L, lua_upvalueindex(1));
@@ -500,6 +582,7 @@ luaopen_skynet_core(lua_State *L) {
 		{ "send" , lsend },
 		{ "genid", lgenid },
 		{ "redirect", lredirect },
+		{ "fanout", lfanout },
 		{ "command" , lcommand },
 		{ "intcommand", lintcommand },
 		{ "addresscommand", laddresscommand },
@@ -514,7 +597,10 @@ luaopen_skynet_core(lua_State *L) {
 	luaL_Reg l2[] = {
 		{ "tostring", ltostring },
 		{ "pack", luaseri_pack },
+		{ "packdict", luaseri_packdict },
 		{ "unpack", luaseri_unpack },
+		{ "peek", luaseri_peek },
+		{ "unpack_lazy", luaseri_lazy },
 		{ "packstring", lpackstring },
 		{ "trash" , ltrash },
 		{ "now", lnow },
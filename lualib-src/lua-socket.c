@@ -575,6 +575,18 @@ lsendlow(lua_State *L) {
 	return 1;
 }
 
+static int
+lsendfile(lua_State *L) {
+	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
+	int id = luaL_checkinteger(L, 1);
+	const char * filename = luaL_checkstring(L, 2);
+	lua_Integer offset = luaL_optinteger(L, 3, 0);
+	lua_Integer sz = luaL_optinteger(L, 4, -1);
+	int err = skynet_socket_sendfile(ctx, id, filename, offset, sz);
+	lua_pushboolean(L, !err);
+	return 1;
+}
+
 static int
 lbind(lua_State *L) {
 	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
@@ -600,6 +612,30 @@ lnodelay(lua_State *L) {
 	return 0;
 }
 
+static int
+lpause(lua_State *L) {
+	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
+	int id = luaL_checkinteger(L, 1);
+	skynet_socket_pause(ctx,id);
+	return 0;
+}
+
+static int
+lresume(lua_State *L) {
+	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
+	int id = luaL_checkinteger(L, 1);
+	skynet_socket_resume(ctx,id);
+	return 0;
+}
+
+static int
+lzerocopy(lua_State *L) {
+	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
+	int id = luaL_checkinteger(L, 1);
+	skynet_socket_zerocopy(ctx,id);
+	return 0;
+}
+
 static int
 ludp(lua_State *L) {
 	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
@@ -654,6 +690,51 @@ ludp_send(lua_State *L) {
 	return 1;
 }
 
+static int
+ludp_batch(lua_State *L) {
+	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
+	int id = luaL_checkinteger(L, 1);
+	int enable = lua_isnoneornil(L, 2) ? 1 : lua_toboolean(L, 2);
+	skynet_socket_udp_batch(ctx, id, enable);
+	return 0;
+}
+
+/*
+	userdata msg, integer size (SKYNET_SOCKET_TYPE_UDP_BATCH)
+	return table { data1, address1, data2, address2, ... }
+ */
+static int
+ludp_unpack(lua_State *L) {
+	const uint8_t * ptr = lua_touserdata(L, 1);
+	int size = luaL_checkinteger(L, 2);
+	if (ptr == NULL) {
+		return luaL_error(L, "Invalid udp batch");
+	}
+	const uint8_t * end = ptr + size;
+	lua_newtable(L);
+	int n = 0;
+	while (ptr < end) {
+		uint32_t sz;
+		if (end - ptr < sizeof(sz) + 1) {
+			return luaL_error(L, "Invalid udp batch");
+		}
+		memcpy(&sz, ptr, sizeof(sz));
+		ptr += sizeof(sz);
+		int addrsz = *ptr++;
+		if (end - ptr < addrsz + sz) {
+			return luaL_error(L, "Invalid udp batch");
+		}
+		const uint8_t * addr = ptr;
+		ptr += addrsz;
+		lua_pushlstring(L, (const char *)ptr, sz);
+		lua_rawseti(L, -2, ++n);
+		lua_pushlstring(L, (const char *)addr, addrsz);
+		lua_rawseti(L, -2, ++n);
+		ptr += sz;
+	}
+	return 1;
+}
+
 static int
 ludp_address(lua_State *L) {
 	size_t sz = 0;
@@ -762,6 +843,7 @@ luaopen_skynet_socketdriver(lua_State *L) {
 		{ "info", linfo },
 
 		{ "unpack", lunpack },
+		{ "udp_unpack", ludp_unpack },
 		{ NULL, NULL },
 	};
 	luaL_newlib(L,l);
@@ -772,12 +854,17 @@ luaopen_skynet_socketdriver(lua_State *L) {
 		{ "listen", llisten },
 		{ "send", lsend },
 		{ "lsend", lsendlow },
+		{ "sendfile", lsendfile },
 		{ "bind", lbind },
 		{ "start", lstart },
 		{ "nodelay", lnodelay },
+		{ "zerocopy", lzerocopy },
+		{ "pause", lpause },
+		{ "resume", lresume },
 		{ "udp", ludp },
 		{ "udp_connect", ludp_connect },
 		{ "udp_send", ludp_send },
+		{ "udp_batch", ludp_batch },
 		{ "udp_address", ludp_address },
 		{ NULL, NULL },
 	};
@@ -197,13 +197,34 @@ function suspend(co, result, command)
 	end
 end
 
-function skynet.timeout(ti, func)
-	local session = c.intcommand("TIMEOUT",ti)
+local function timeout(session, func)
 	assert(session)
 	local co = co_create(func)
 	assert(session_id_coroutine[session] == nil)
 	session_id_coroutine[session] = co
-	return co	-- for debug
+	return co, session	-- co for debug, session for skynet.canceltimeout
+end
+
+function skynet.timeout(ti, func)
+	return timeout(c.intcommand("TIMEOUT",ti), func)
+end
+
+-- ti in millisecond, the precision depends on timer_tick in config
+function skynet.timeout_ms(ti, func)
+	return timeout(c.intcommand("TIMEOUTMS",ti), func)
+end
+
+-- return true if the timeout is cancelled before it expires
+function skynet.canceltimeout(session)
+	if session_id_coroutine[session] == nil then
+		return false
+	end
+	if c.intcommand("CANCELTIMEOUT", session) == 1 then
+		-- the coroutine never runs, leave it to gc
+		session_id_coroutine[session] = nil
+		return true
+	end
+	return false
 end
 
 local function suspend_sleep(session, token)
@@ -216,8 +237,7 @@ local function suspend_sleep(session, token)
 	return coroutine_yield "SUSPEND"
 end
 
-function skynet.sleep(ti, token)
-	local session = c.intcommand("TIMEOUT",ti)
+local function sleep(session, token)
 	assert(session)
 	token = token or coroutine.running()
 	local succ, ret = suspend_sleep(session, token)
@@ -232,6 +252,15 @@ function skynet.sleep(ti, token)
 	end
 end
 
+function skynet.sleep(ti, token)
+	return sleep(c.intcommand("TIMEOUT",ti), token)
+end
+
+-- ti in millisecond, the precision depends on timer_tick in config
+function skynet.sleep_ms(ti, token)
+	return sleep(c.intcommand("TIMEOUTMS",ti), token)
+end
+
 function skynet.yield()
 	return skynet.sleep(0)
 end
@@ -337,6 +366,17 @@ function skynet.rawsend(addr, typename, msg, sz)
 	return c.send(addr, p.id, 0 , msg, sz)
 end
 
+-- send the same message to a list of addresses (or local names), it's packed once and shared by the receivers (not copied).
+function skynet.fanout(addrs, typename, ...)
+	local p = proto[typename]
+	return c.fanout(addrs, p.id, p.pack(...))
+end
+
+function skynet.rawfanout(addrs, typename, msg, sz)
+	local p = proto[typename]
+	return c.fanout(addrs, p.id, msg, sz)
+end
+
 skynet.genid = assert(c.genid)
 
 skynet.redirect = function(dest,source,typename,...)
@@ -344,8 +384,11 @@ skynet.redirect = function(dest,source,typename,...)
 end
 
 skynet.pack = assert(c.pack)
+skynet.packdict = assert(c.packdict)	-- the same keys of the tables in a message are packed once, skynet.unpack reads it too
 skynet.packstring = assert(c.packstring)
 skynet.unpack = assert(c.unpack)
+skynet.peek = assert(c.peek)	-- skynet.peek(msg, sz, n) unpacks the first n values
+skynet.unpack_lazy = assert(c.unpack_lazy)	-- returns a proxy (of a copy of msg), the fields are unpacked when they're read
 skynet.tostring = assert(c.tostring)
 skynet.trash = assert(c.trash)
 
@@ -799,6 +842,19 @@ function skynet.stat(what)
 	return c.intcommand("STAT", what)
 end
 
+-- class : "high", "normal" or "low" ; budget : cpu time (microsec) per 0.1 sec, 0 for unlimited
+function skynet.priority(class, budget)
+	if class == nil then
+		return c.command "PRIORITY"
+	end
+	if budget then
+		local n = tonumber(budget)
+		assert(n and n >= 0, "budget should be a non-negative number (microsec)")
+		class = class .. " " .. math.floor(n)
+	end
+	return c.command("PRIORITY", class)
+end
+
 function skynet.task(ret)
 	if ret == nil then
 		local t = 0
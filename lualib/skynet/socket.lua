@@ -136,6 +136,22 @@ socket_message[6] = function(id, size, data, address)
 	s.callback(str, address)
 end
 
+-- SKYNET_SOCKET_TYPE_UDP_BATCH = 8
+socket_message[8] = function(id, size, data)
+	local s = socket_pool[id]
+	if s == nil or s.callback == nil then
+		skynet.error("socket: drop udp package from " .. id)
+		driver.drop(data, size)
+		return
+	end
+	local packages = driver.udp_unpack(data, size)
+	skynet_core.trash(data, size)
+	local callback = s.callback
+	for i=1,#packages,2 do
+		callback(packages[i], packages[i+1])
+	end
+end
+
 local function default_warning(id, size)
 	local s = socket_pool[id]
 	if not s then
@@ -339,6 +355,14 @@ end
 
 socket.write = assert(driver.send)
 socket.lwrite = assert(driver.lsend)
+-- socket.sendfile(id, filename, offset, size) : the file is sent by the socket thread, size (default) to the end of file
+socket.sendfile = assert(driver.sendfile)
+-- the large buffers written are sent by MSG_ZEROCOPY, see socket_server_zerocopy
+socket.zerocopy = assert(driver.zerocopy)
+-- stop reading the socket (the peer is blocked by tcp flow control) until socket.resume(id).
+-- The socket is also paused by itself when the message queue of the service is too long.
+socket.pause = assert(driver.pause)
+socket.resume = assert(driver.resume)
 socket.header = assert(driver.header)
 
 function socket.invalid(id)
@@ -415,6 +439,8 @@ local function create_udp_object(id, cb)
 		protocol = "UDP",
 		callback = cb,
 	}
+	-- the datagrams come in batch (SKYNET_SOCKET_TYPE_UDP_BATCH), the callback is still called for each one.
+	driver.udp_batch(id)
 end
 
 function socket.udp(callback, host, port)
@@ -17,6 +17,7 @@ struct snlua {
 	size_t mem;
 	size_t mem_report;
 	size_t mem_limit;
+	struct skynet_arena * arena;
 };
 
 // LUA_CACHELIB may defined in patched lua for shared proto
@@ -152,6 +153,7 @@ snlua_init(struct snlua *l, struct skynet_context *ctx, const char * args) {
 	skynet_callback(ctx, l , launch_cb);
 	const char * self = skynet_command(ctx, "REG", NULL);
 	uint32_t handle_id = strtoul(self+1, NULL, 16);
+	skynet_arena_owner(l->arena, handle_id);
 	// it must be first message
 	skynet_send(ctx, 0, handle_id, PTYPE_TAG_DONTCOPY,0, tmp, sz);
 	return 0;
@@ -174,15 +176,36 @@ lalloc(void * ud, void *ptr, size_t osize, size_t nsize) {
 		l->mem_report *= 2;
 		skynet_error(l->ctx, "Memory warning %.2f M", (float)l->mem / (1024 * 1024));
 	}
+	if (l->arena) {
+		return skynet_arena_lalloc(l->arena, ptr, osize, nsize);
+	}
 	return skynet_lalloc(ptr, osize, nsize);
 }
 
+// lua_arena = "service" : a jemalloc arena for each service ; lua_arena = N : the services share N arenas
+static struct skynet_arena *
+lua_arena(void) {
+	const char * mode = skynet_command(NULL, "GETENV", "lua_arena");
+	if (mode == NULL) {
+		return NULL;
+	}
+	if (strcmp(mode, "service") == 0) {
+		return skynet_arena_new(0);
+	}
+	int n = strtol(mode, NULL, 10);
+	if (n > 0) {
+		return skynet_arena_new(n);
+	}
+	return NULL;
+}
+
 struct snlua *
 snlua_create(void) {
 	struct snlua * l = skynet_malloc(sizeof(*l));
 	memset(l,0,sizeof(*l));
 	l->mem_report = MEMORY_WARNING_REPORT;
 	l->mem_limit = 0;
+	l->arena = lua_arena();
 	l->L = lua_newstate(lalloc, l);
 	return l;
 }
@@ -190,6 +213,7 @@ snlua_create(void) {
 void
 snlua_release(struct snlua *l) {
 	lua_close(l->L);
+	skynet_arena_delete(l->arena);
 	skynet_free(l);
 }
 
@@ -2,19 +2,27 @@
 #include <string.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <stdbool.h>
 #include <lua.h>
 #include <stdio.h>
 
 #include "malloc_hook.h"
 #include "skynet.h"
 #include "atomic.h"
+#include "spinlock.h"
 
 // turn on MEMORY_CHECK can do more memory check, such as double free
 #define MEMORY_CHECK
 
 #define MEMORY_ALLOCTAG 0x20140605
 #define MEMORY_FREETAG 0x0badf00d
+// the low 4 bits is the size class of the pooled block, see skynet_malloc_pooled
+#define MEMORY_POOLTAG 0x20170300
+#define IS_POOLTAG(tag) (((tag) & ~0xf) == MEMORY_POOLTAG)
+// the immutable block shared by many messages, see skynet_shared
+#define MEMORY_SHAREDTAG 0x20170500
 
+// the threads more than MAX_MEM_SHARD share these counters (see struct mem_shard)
 static size_t _used_memory = 0;
 static size_t _memory_block = 0;
 
@@ -35,6 +43,54 @@ struct mem_cookie {
 
 static struct mem_data mem_stats[SLOT_SIZE];
 
+/*
+	The counters are sharded by thread, so alloc and free don't touch a shared cache line.
+
+	Each thread owns a shard, and updates it without atomic operations. The shard caches the allocated bytes
+	of a few services (by handle hash), an entry is flushed into mem_stats when another service takes it.
+	The readers (malloc_used_memory, dump_c_mem, memory.info ...) add the shards up, it's a snapshot as before.
+ */
+
+#define MAX_MEM_SHARD 128
+#define MEM_CACHE_SIZE 16
+#define CACHELINE_SIZE 64
+
+struct mem_cache {
+	volatile uint32_t handle;
+	volatile ssize_t allocated;	// not in mem_stats yet
+};
+
+struct mem_shard {
+	volatile ssize_t used;
+	volatile ssize_t block;
+	struct mem_cache cache[MEM_CACHE_SIZE];
+	char pad[CACHELINE_SIZE - 2 * sizeof(ssize_t)];
+};
+
+static struct mem_shard mem_shards[MAX_MEM_SHARD] __attribute__((aligned(CACHELINE_SIZE)));
+static int mem_shard_count = 0;
+
+static int
+shard_count(void) {
+	int n = mem_shard_count;
+	return n < MAX_MEM_SHARD ? n : MAX_MEM_SHARD;
+}
+
+// the allocated bytes of handle which are not flushed into mem_stats
+static ssize_t
+shard_allocated(uint32_t handle) {
+	ssize_t allocated = 0;
+	int n = shard_count();
+	int i;
+	for (i=0;i<n;i++) {
+		struct mem_cache *c = &mem_shards[i].cache[handle & (MEM_CACHE_SIZE-1)];
+		if (c->handle == handle) {
+			allocated += c->allocated;
+		}
+	}
+	return allocated;
+}
+
 
 #ifndef NOUSE_JEMALLOC
 
@@ -50,7 +106,8 @@ get_allocated_field(uint32_t handle) {
 	struct mem_data *data = &mem_stats[h];
 	uint32_t old_handle = data->handle;
 	ssize_t old_alloc = data->allocated;
-	if(old_handle == 0 || old_alloc <= 0) {
+	// the shard caches may still hold the allocated bytes of old_handle, when it frees on another thread.
+	if(old_handle == 0 || (old_alloc <= 0 && old_alloc + shard_allocated(old_handle) <= 0)) {
 		// data->allocated may less than zero, because it may not count at start.
 		if(!ATOM_CAS(&data->handle, old_handle, handle)) {
 			return 0;
@@ -65,40 +122,94 @@ get_allocated_field(uint32_t handle) {
 	return &data->allocated;
 }
 
+static __thread struct mem_shard * SHARD = NULL;
+static __thread int SHARD_OVERFLOW = 0;
+
+static inline struct mem_shard *
+get_shard(void) {
+	struct mem_shard *s = SHARD;
+	if (s == NULL && !SHARD_OVERFLOW) {
+		int id = ATOM_FINC(&mem_shard_count);
+		if (id < MAX_MEM_SHARD) {
+			s = SHARD = &mem_shards[id];
+		} else {
+			SHARD_OVERFLOW = 1;
+		}
+	}
+	return s;
+}
+
+static struct mem_cache *
+get_cache(struct mem_shard *s, uint32_t handle) {
+	struct mem_cache *c = &s->cache[handle & (MEM_CACHE_SIZE-1)];
+	if (c->handle != handle) {
+		ssize_t n = c->allocated;
+		if (n != 0) {
+			c->allocated = 0;
+			ssize_t* allocated = get_allocated_field(c->handle);
+			if(allocated) {
+				ATOM_ADD(allocated, n);
+			}
+		}
+		c->handle = handle;
+		// take the slot of mem_stats now, so dump_c_mem can find it.
+		get_allocated_field(handle);
+	}
+	return c;
+}
+
 inline static void 
 update_xmalloc_stat_alloc(uint32_t handle, size_t __n) {
-	ATOM_ADD(&_used_memory, __n);
-	ATOM_INC(&_memory_block); 
-	ssize_t* allocated = get_allocated_field(handle);
-	if(allocated) {
-		ATOM_ADD(allocated, __n);
+	struct mem_shard *s = get_shard();
+	if (s == NULL) {
+		ATOM_ADD(&_used_memory, __n);
+		ATOM_INC(&_memory_block); 
+		ssize_t* allocated = get_allocated_field(handle);
+		if(allocated) {
+			ATOM_ADD(allocated, __n);
+		}
+		return;
 	}
+	s->used += __n;
+	s->block++;
+	get_cache(s, handle)->allocated += __n;
 }
 
 inline static void
 update_xmalloc_stat_free(uint32_t handle, size_t __n) {
-	ATOM_SUB(&_used_memory, __n);
-	ATOM_DEC(&_memory_block);
-	ssize_t* allocated = get_allocated_field(handle);
-	if(allocated) {
-		ATOM_SUB(allocated, __n);
+	struct mem_shard *s = get_shard();
+	if (s == NULL) {
+		ATOM_SUB(&_used_memory, __n);
+		ATOM_DEC(&_memory_block);
+		ssize_t* allocated = get_allocated_field(handle);
+		if(allocated) {
+			ATOM_SUB(allocated, __n);
+		}
+		return;
 	}
+	s->used -= __n;
+	s->block--;
+	get_cache(s, handle)->allocated -= __n;
 }
 
 inline static void*
-fill_prefix(char* ptr) {
+fill_prefix_tag(char* ptr, uint32_t dogtag) {
 	uint32_t handle = skynet_current_handle();
 	size_t size = je_malloc_usable_size(ptr);
 	struct mem_cookie *p = (struct mem_cookie *)(ptr + size - sizeof(struct mem_cookie));
 	memcpy(&p->handle, &handle, sizeof(handle));
 #ifdef MEMORY_CHECK
-	uint32_t dogtag = MEMORY_ALLOCTAG;
 	memcpy(&p->dogtag, &dogtag, sizeof(dogtag));
 #endif
 	update_xmalloc_stat_alloc(handle, size);
 	return ptr;
 }
 
+inline static void*
+fill_prefix(char* ptr) {
+	return fill_prefix_tag(ptr, MEMORY_ALLOCTAG);
+}
+
 inline static void*
 clean_prefix(char* ptr) {
 	size_t size = je_malloc_usable_size(ptr);
@@ -111,7 +222,7 @@ clean_prefix(char* ptr) {
 	if (dogtag == MEMORY_FREETAG) {
 		fprintf(stderr, "xmalloc: double free in :%08x\n", handle);
 	}
-	assert(dogtag == MEMORY_ALLOCTAG);	// memory out of bounds
+	assert(dogtag == MEMORY_ALLOCTAG || IS_POOLTAG(dogtag) || dogtag == MEMORY_SHAREDTAG);	// memory out of bounds
 	dogtag = MEMORY_FREETAG;
 	memcpy(&p->dogtag, &dogtag, sizeof(dogtag));
 #endif
@@ -162,6 +273,425 @@ mallctl_opt(const char* name, int* newval) {
 	return v;
 }
 
+// one arena for each numa node, created when the first thread of the node binds.
+#define MAX_NODE_ARENA 64
+
+// static storage is zeroed, as an unlocked spinlock
+static struct {
+	struct spinlock lock;
+	unsigned arena[MAX_NODE_ARENA];
+} NODE_ARENA;
+
+static int
+create_arena(unsigned *arena) {
+	unsigned a = 0;
+	size_t len = sizeof(a);
+	// arenas.create is for jemalloc 5, arenas.extend for older version
+	if (je_mallctl("arenas.create", &a, &len, NULL, 0) != 0 &&
+		je_mallctl("arenas.extend", &a, &len, NULL, 0) != 0) {
+		return 1;
+	}
+	*arena = a;
+	return 0;
+}
+
+static int
+node_arena(int node, unsigned *arena) {
+	int ret = 0;
+	SPIN_LOCK(&NODE_ARENA)
+	if (NODE_ARENA.arena[node] == 0) {
+		unsigned a = 0;
+		if (create_arena(&a)) {
+			ret = 1;
+		} else {
+			NODE_ARENA.arena[node] = a;
+		}
+	}
+	*arena = NODE_ARENA.arena[node];
+	SPIN_UNLOCK(&NODE_ARENA)
+	return ret;
+}
+
+int
+skynet_malloc_bindnode(int node) {
+	if (node < 0 || node >= MAX_NODE_ARENA)
+		return 1;
+	unsigned arena;
+	if (node_arena(node, &arena))
+		return 1;
+	return je_mallctl("thread.arena", NULL, NULL, &arena, sizeof(arena));
+}
+
+/*
+	The arenas for the lua states (see lua_arena in config).
+
+	A dedicated arena belongs to one service. When the service exits, the arena is reset (the memory is freed in one shot)
+	and purged, then it's reused by the next service. The shared arenas are for the groups of services, they are never released.
+
+	A service runs in one thread at a time, so it has its own thread cache. The lua allocations don't go through
+	the cache of the worker thread, which mixes the memory of all the services run by the worker.
+ */
+
+#define MAX_SHARED_ARENA 64
+
+struct skynet_arena {
+	unsigned arena;
+	unsigned tcache;
+	bool own_tcache;
+	int flags;
+	bool shared;
+	uint32_t handle;
+	struct skynet_arena * prev;
+	struct skynet_arena * next;
+};
+
+// static storage is zeroed, as an unlocked spinlock
+static struct {
+	struct spinlock lock;
+	struct skynet_arena * list;
+	// the dedicated arenas released
+	int nfree;
+	int cap;
+	unsigned * free;
+	unsigned shared[MAX_SHARED_ARENA];
+	unsigned shared_index;
+} LUA_ARENA;
+
+static int
+lua_arena_get(int shared, unsigned *arena) {
+	int ret = 0;
+	SPIN_LOCK(&LUA_ARENA)
+	if (shared > 0) {
+		if (shared > MAX_SHARED_ARENA) {
+			shared = MAX_SHARED_ARENA;
+		}
+		unsigned *a = &LUA_ARENA.shared[LUA_ARENA.shared_index++ % shared];
+		// arena 0 is the default one, never be created.
+		if (*a == 0) {
+			ret = create_arena(a);
+		}
+		*arena = *a;
+	} else if (LUA_ARENA.nfree > 0) {
+		*arena = LUA_ARENA.free[--LUA_ARENA.nfree];
+	} else {
+		ret = create_arena(arena);
+	}
+	SPIN_UNLOCK(&LUA_ARENA)
+	return ret;
+}
+
+struct skynet_arena *
+skynet_arena_new(int shared) {
+	unsigned arena;
+	if (lua_arena_get(shared, &arena))
+		return NULL;
+	struct skynet_arena *a = skynet_malloc(sizeof(*a));
+	a->arena = arena;
+	a->flags = MALLOCX_ARENA(arena);
+	size_t len = sizeof(a->tcache);
+	a->own_tcache = je_mallctl("tcache.create", &a->tcache, &len, NULL, 0) == 0;
+	if (a->own_tcache) {
+		a->flags |= MALLOCX_TCACHE(a->tcache);
+	} else {
+		// the arena can't be reset if its memory is in the cache of the worker thread.
+		a->flags |= MALLOCX_TCACHE_NONE;
+	}
+	a->shared = shared > 0;
+	a->handle = 0;
+	a->prev = NULL;
+	SPIN_LOCK(&LUA_ARENA)
+	a->next = LUA_ARENA.list;
+	if (a->next) {
+		a->next->prev = a;
+	}
+	LUA_ARENA.list = a;
+	SPIN_UNLOCK(&LUA_ARENA)
+	return a;
+}
+
+void
+skynet_arena_owner(struct skynet_arena *a, uint32_t handle) {
+	if (a) {
+		a->handle = handle;
+	}
+}
+
+static int
+arena_ctl(const char *fmt, unsigned arena) {
+	char name[64];
+	snprintf(name, sizeof(name), fmt, arena);
+	return je_mallctl(name, NULL, NULL, NULL, 0);
+}
+
+void
+skynet_arena_delete(struct skynet_arena *a) {
+	if (a == NULL)
+		return;
+	SPIN_LOCK(&LUA_ARENA)
+	if (a->prev) {
+		a->prev->next = a->next;
+	} else {
+		LUA_ARENA.list = a->next;
+	}
+	if (a->next) {
+		a->next->prev = a->prev;
+	}
+	SPIN_UNLOCK(&LUA_ARENA)
+	if (a->own_tcache) {
+		je_mallctl("tcache.destroy", NULL, NULL, &a->tcache, sizeof(a->tcache));
+	}
+	if (!a->shared) {
+		// lua_close frees all the lua objects, reset drops the rest (leaked by C modules) if it's supported (jemalloc 4.3+).
+		arena_ctl("arena.%u.reset", a->arena);
+		arena_ctl("arena.%u.purge", a->arena);
+		SPIN_LOCK(&LUA_ARENA)
+		if (LUA_ARENA.nfree >= LUA_ARENA.cap) {
+			LUA_ARENA.cap = LUA_ARENA.cap == 0 ? 16 : LUA_ARENA.cap * 2;
+			LUA_ARENA.free = skynet_realloc(LUA_ARENA.free, LUA_ARENA.cap * sizeof(unsigned));
+		}
+		LUA_ARENA.free[LUA_ARENA.nfree++] = a->arena;
+		SPIN_UNLOCK(&LUA_ARENA)
+	}
+	skynet_free(a);
+}
+
+void *
+skynet_arena_lalloc(struct skynet_arena *a, void *ptr, size_t osize, size_t nsize) {
+	if (nsize == 0) {
+		if (ptr) {
+			je_dallocx(ptr, a->flags);
+		}
+		return NULL;
+	}
+	if (ptr == NULL) {
+		return je_mallocx(nsize, a->flags);
+	}
+	return je_rallocx(ptr, nsize, a->flags);
+}
+
+static size_t
+arena_resident(unsigned arena) {
+	char name[64];
+	size_t v = 0;
+	size_t len = sizeof(v);
+	snprintf(name, sizeof(name), "stats.arenas.%u.resident", arena);
+	if (je_mallctl(name, &v, &len, NULL, 0) == 0)
+		return v;
+	// jemalloc 4 : the active pages
+	size_t page = 0;
+	len = sizeof(page);
+	snprintf(name, sizeof(name), "stats.arenas.%u.pactive", arena);
+	if (je_mallctl(name, &v, &len, NULL, 0) != 0 || je_mallctl("arenas.page", &page, &len, NULL, 0) != 0)
+		return 0;
+	return v * page;
+}
+
+// push {handle = resident bytes of the arena} , the services of a group share one arena.
+static int
+arena_info(lua_State *L) {
+	uint64_t epoch = 1;
+	size_t len = sizeof(epoch);
+	// refresh the stats
+	je_mallctl("epoch", &epoch, &len, &epoch, len);
+	lua_newtable(L);
+	SPIN_LOCK(&LUA_ARENA)
+	struct skynet_arena *a;
+	for (a = LUA_ARENA.list; a; a = a->next) {
+		if (a->handle != 0) {
+			lua_pushinteger(L, (lua_Integer)arena_resident(a->arena));
+			lua_rawseti(L, -2, (lua_Integer)a->handle);
+		}
+	}
+	SPIN_UNLOCK(&LUA_ARENA)
+	return 1;
+}
+
+#ifdef MEMORY_CHECK
+
+/*
+	Pooled blocks for the socket read buffers (see skynet_malloc_pooled).
+
+	The size classes are 64 << n (n < POOL_CLASS), the class is kept in the dogtag of the cookie,
+	so skynet_free can recognize a pooled block which is freed by any service in any thread.
+
+	A freed block goes into the cache of the current thread. When the cache of a class is full,
+	the whole cache is moved to the global list of the class as a batch, and the thread (the socket thread usually)
+	which runs out of its cache takes a batch back. So the lock is taken once per batch.
+	The caches are not released at thread exit, the threads of skynet live as long as the process.
+ */
+
+#define POOL_CLASS 11
+#define POOL_MIN_SHIFT 6
+#define POOL_CACHE_BYTES (128 * 1024)
+#define POOL_CACHE_MAX 32
+#define POOL_GLOBAL_BYTES (4 * 1024 * 1024)
+
+struct pool_block {
+	struct pool_block * next;
+	// for the first block of a batch in the global list
+	struct pool_block * batch;
+	int n;
+};
+
+struct pool_cache {
+	struct pool_block * head[POOL_CLASS];
+	int n[POOL_CLASS];
+};
+
+static __thread struct pool_cache POOL_CACHE;
+
+// static storage is zeroed, as an unlocked spinlock
+static struct pool_global {
+	struct spinlock lock;
+	struct pool_block * batch;
+	int n;
+} POOL_GLOBAL[POOL_CLASS];
+
+static inline int
+pool_class(size_t size) {
+	int c = 0;
+	while (((size_t)1 << (c + POOL_MIN_SHIFT)) < size) {
+		++c;
+	}
+	return c;
+}
+
+static inline int
+pool_cache_limit(int c) {
+	int limit = POOL_CACHE_BYTES >> (c + POOL_MIN_SHIFT);
+	return limit > POOL_CACHE_MAX ? POOL_CACHE_MAX : limit;
+}
+
+static void *
+pool_get(int c) {
+	struct pool_cache *cache = &POOL_CACHE;
+	if (cache->n[c] == 0) {
+		struct pool_global *g = &POOL_GLOBAL[c];
+		struct pool_block * b;
+		SPIN_LOCK(g)
+		b = g->batch;
+		if (b) {
+			g->batch = b->batch;
+			g->n -= b->n;
+		}
+		SPIN_UNLOCK(g)
+		if (b == NULL)
+			return NULL;
+		cache->head[c] = b;
+		cache->n[c] = b->n;
+	}
+	struct pool_block * b = cache->head[c];
+	cache->head[c] = b->next;
+	--cache->n[c];
+	return b;
+}
+
+static void
+pool_put(int c, void *ptr) {
+	struct pool_cache *cache = &POOL_CACHE;
+	struct pool_block * b = (struct pool_block *)ptr;
+	if (cache->n[c] >= pool_cache_limit(c)) {
+		struct pool_global *g = &POOL_GLOBAL[c];
+		struct pool_block * batch = cache->head[c];
+		int n = cache->n[c];
+		batch->n = n;
+		int full;
+		SPIN_LOCK(g)
+		full = ((g->n + n) << (c + POOL_MIN_SHIFT)) > POOL_GLOBAL_BYTES;
+		if (!full) {
+			batch->batch = g->batch;
+			g->batch = batch;
+			g->n += n;
+		}
+		SPIN_UNLOCK(g)
+		if (full) {
+			while (batch) {
+				struct pool_block * next = batch->next;
+				je_free(batch);
+				batch = next;
+			}
+		}
+		cache->head[c] = NULL;
+		cache->n[c] = 0;
+	}
+	b->next = cache->head[c];
+	cache->head[c] = b;
+	++cache->n[c];
+}
+
+static inline uint32_t
+get_dogtag(void *ptr) {
+	size_t size = je_malloc_usable_size(ptr);
+	struct mem_cookie *p = (struct mem_cookie *)((char *)ptr + size - sizeof(struct mem_cookie));
+	uint32_t dogtag;
+	memcpy(&dogtag, &p->dogtag, sizeof(dogtag));
+	return dogtag;
+}
+
+// returns the class of a pooled block, or -1
+static inline int
+pool_tag(uint32_t dogtag) {
+	if (IS_POOLTAG(dogtag)) {
+		return (int)(dogtag & 0xf);
+	}
+	return -1;
+}
+
+/*
+	A shared block keeps its reference count before the cookie, skynet_free releases one reference,
+	and frees the block when the last one is released. So the receivers of the messages don't know it's shared.
+ */
+
+static inline int *
+shared_ref(void *ptr) {
+	size_t size = je_malloc_usable_size(ptr);
+	return (int *)((char *)ptr + size - sizeof(struct mem_cookie) - sizeof(int));
+}
+
+void *
+skynet_shared(void *ptr, size_t sz, int ref) {
+	uint32_t tag = get_dogtag(ptr);
+	assert(ref > 0 && (tag == MEMORY_ALLOCTAG || IS_POOLTAG(tag)));
+	// room for the reference count, it's in place usually.
+	ptr = skynet_realloc(ptr, sz + sizeof(int));
+	*shared_ref(ptr) = ref;
+	size_t size = je_malloc_usable_size(ptr);
+	struct mem_cookie *p = (struct mem_cookie *)((char *)ptr + size - sizeof(struct mem_cookie));
+	uint32_t dogtag = MEMORY_SHAREDTAG;
+	memcpy(&p->dogtag, &dogtag, sizeof(dogtag));
+	// publish the block to other threads
+	__sync_synchronize();
+	return ptr;
+}
+
+void *
+skynet_malloc_pooled(size_t size) {
+	int c = pool_class(size);
+	if (c >= POOL_CLASS) {
+		return skynet_malloc(size);
+	}
+	void * ptr = pool_get(c);
+	if (ptr == NULL) {
+		ptr = je_malloc(((size_t)1 << (c + POOL_MIN_SHIFT)) + PREFIX_SIZE);
+		if(!ptr) malloc_oom(size);
+	}
+	return fill_prefix_tag(ptr, MEMORY_POOLTAG | c);
+}
+
+#else
+
+void *
+skynet_malloc_pooled(size_t size) {
+	return skynet_malloc(size);
+}
+
+void *
+skynet_shared(void *ptr, size_t sz, int ref) {
+	return NULL;
+}
+
+#endif
+
 // hook : malloc, realloc, free, calloc
 
 void *
@@ -175,6 +705,9 @@ void *
 skynet_realloc(void *ptr, size_t size) {
 	if (ptr == NULL) return skynet_malloc(size);
 
+#ifdef MEMORY_CHECK
+	assert(get_dogtag(ptr) != MEMORY_SHAREDTAG);	// the shared block is immutable
+#endif
 	void* rawptr = clean_prefix(ptr);
 	void *newptr = je_realloc(rawptr, size+PREFIX_SIZE);
 	if(!newptr) malloc_oom(size);
@@ -184,7 +717,20 @@ skynet_realloc(void *ptr, size_t size) {
 void
 skynet_free(void *ptr) {
 	if (ptr == NULL) return;
+#ifdef MEMORY_CHECK
+	uint32_t dogtag = get_dogtag(ptr);
+	if (dogtag == MEMORY_SHAREDTAG && ATOM_DEC(shared_ref(ptr)) > 0) {
+		return;
+	}
+	int c = pool_tag(dogtag);
 	void* rawptr = clean_prefix(ptr);
+	if (c >= 0) {
+		pool_put(c, rawptr);
+		return;
+	}
+#else
+	void* rawptr = clean_prefix(ptr);
+#endif
 	je_free(rawptr);
 }
 
@@ -240,16 +786,77 @@ mallctl_opt(const char* name, int* newval) {
 	return 0;
 }
 
+void *
+skynet_malloc_pooled(size_t size) {
+	// no cookie to recognize the pooled block when it's freed
+	return malloc(size);
+}
+
+void *
+skynet_shared(void *ptr, size_t sz, int ref) {
+	// no cookie to keep the reference count
+	return NULL;
+}
+
+int
+skynet_malloc_bindnode(int node) {
+	// libc malloc uses thread arenas, the memory is local if the thread is bound to the node.
+	return 1;
+}
+
+struct skynet_arena *
+skynet_arena_new(int shared) {
+	return NULL;
+}
+
+void
+skynet_arena_owner(struct skynet_arena *a, uint32_t handle) {
+}
+
+void
+skynet_arena_delete(struct skynet_arena *a) {
+}
+
+void *
+skynet_arena_lalloc(struct skynet_arena *a, void *ptr, size_t osize, size_t nsize) {
+	return skynet_lalloc(ptr, osize, nsize);
+}
+
+static int
+arena_info(lua_State *L) {
+	return 0;
+}
+
 #endif
 
 size_t
 malloc_used_memory(void) {
-	return _used_memory;
+	ssize_t used = (ssize_t)_used_memory;
+	int n = shard_count();
+	int i;
+	for (i=0;i<n;i++) {
+		used += mem_shards[i].used;
+	}
+	return (size_t)used;
 }
 
 size_t
 malloc_memory_block(void) {
-	return _memory_block;
+	ssize_t block = (ssize_t)_memory_block;
+	int n = shard_count();
+	int i;
+	for (i=0;i<n;i++) {
+		block += mem_shards[i].block;
+	}
+	return (size_t)block;
+}
+
+static ssize_t
+service_allocated(struct mem_data *data) {
+	uint32_t handle = data->handle;
+	if (handle == 0)
+		return 0;
+	return data->allocated + shard_allocated(handle);
 }
 
 void
@@ -259,9 +866,10 @@ dump_c_mem() {
 	skynet_error(NULL, "dump all service mem:");
 	for(i=0; i<SLOT_SIZE; i++) {
 		struct mem_data* data = &mem_stats[i];
-		if(data->handle != 0 && data->allocated != 0) {
-			total += data->allocated;
-			skynet_error(NULL, ":%08x -> %zdkb %db", data->handle, data->allocated >> 10, (int)(data->allocated % 1024));
+		ssize_t allocated = service_allocated(data);
+		if(allocated != 0) {
+			total += allocated;
+			skynet_error(NULL, ":%08x -> %zdkb %db", data->handle, allocated >> 10, (int)(allocated % 1024));
 		}
 	}
 	skynet_error(NULL, "+total: %zdkb",total >> 10);
@@ -291,12 +899,14 @@ dump_mem_lua(lua_State *L) {
 	lua_newtable(L);
 	for(i=0; i<SLOT_SIZE; i++) {
 		struct mem_data* data = &mem_stats[i];
-		if(data->handle != 0 && data->allocated != 0) {
-			lua_pushinteger(L, data->allocated);
+		ssize_t allocated = service_allocated(data);
+		if(allocated != 0) {
+			lua_pushinteger(L, allocated);
 			lua_rawseti(L, -2, (lua_Integer)data->handle);
 		}
 	}
-	return 1;
+	// the second table is the resident memory of the lua arenas (if lua_arena is set)
+	return 1 + arena_info(L);
 }
 
 size_t
@@ -305,8 +915,8 @@ malloc_current_memory(void) {
 	int i;
 	for(i=0; i<SLOT_SIZE; i++) {
 		struct mem_data* data = &mem_stats[i];
-		if(data->handle == (uint32_t)handle && data->allocated != 0) {
-			return (size_t) data->allocated;
+		if(data->handle == (uint32_t)handle) {
+			return (size_t) service_allocated(data);
 		}
 	}
 	return 0;
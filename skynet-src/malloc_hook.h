@@ -12,6 +12,8 @@ extern int    mallctl_opt(const char* name, int* newval);
 extern void   dump_c_mem(void);
 extern int    dump_mem_lua(lua_State *L);
 extern size_t malloc_current_memory(void);
+// use the allocator arena of numa node for current thread, 0 for success
+extern int    skynet_malloc_bindnode(int node);
 
 #endif /* SKYNET_MALLOC_HOOK_H */
 
@@ -0,0 +1,88 @@
+#ifndef SKYNET_PARKER_H
+#define SKYNET_PARKER_H
+
+// A parker blocks one thread until another thread unparks it.
+// unpark before park is not lost : the next park returns immediately (like a binary semaphore).
+
+#include "atomic.h"
+
+#if defined(__linux__) && !defined(USE_PTHREAD_PARKER)
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+struct parker {
+	volatile int permit;
+};
+
+static inline void
+parker_init(struct parker *p) {
+	p->permit = 0;
+}
+
+static inline void
+parker_park(struct parker *p) {
+	while (!ATOM_CAS(&p->permit, 1, 0)) {
+		syscall(SYS_futex, &p->permit, FUTEX_WAIT_PRIVATE, 0, NULL, NULL, 0);
+	}
+}
+
+static inline void
+parker_unpark(struct parker *p) {
+	if (ATOM_CAS(&p->permit, 0, 1)) {
+		syscall(SYS_futex, &p->permit, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+	}
+}
+
+static inline void
+parker_destroy(struct parker *p) {
+	(void) p;
+}
+
+#else
+
+#include <pthread.h>
+
+struct parker {
+	int permit;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+static inline void
+parker_init(struct parker *p) {
+	p->permit = 0;
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->cond, NULL);
+}
+
+static inline void
+parker_park(struct parker *p) {
+	pthread_mutex_lock(&p->lock);
+	while (p->permit == 0) {
+		pthread_cond_wait(&p->cond, &p->lock);
+	}
+	p->permit = 0;
+	pthread_mutex_unlock(&p->lock);
+}
+
+static inline void
+parker_unpark(struct parker *p) {
+	pthread_mutex_lock(&p->lock);
+	int signal = p->permit == 0;
+	p->permit = 1;
+	pthread_mutex_unlock(&p->lock);
+	if (signal)
+		pthread_cond_signal(&p->cond);
+}
+
+static inline void
+parker_destroy(struct parker *p) {
+	pthread_mutex_destroy(&p->lock);
+	pthread_cond_destroy(&p->cond);
+}
+
+#endif
+
+#endif
@@ -31,6 +31,9 @@ const char * skynet_command(struct skynet_context * context, const char * cmd ,
 uint32_t skynet_queryname(struct skynet_context * context, const char * name);
 int skynet_send(struct skynet_context * context, uint32_t source, uint32_t destination , int type, int session, void * msg, size_t sz);
 int skynet_sendname(struct skynet_context * context, uint32_t source, const char * destination , int type, int session, void * msg, size_t sz);
+// send msg (owned, like PTYPE_TAG_DONTCOPY) to n destinations without copying, the receivers share it (read only).
+// returns the number of failures
+int skynet_send_shared(struct skynet_context * context, uint32_t source, const uint32_t * destination, int n, int type, void * msg, size_t sz);
 
 int skynet_isremote(struct skynet_context *, uint32_t handle, int * harbor);
 
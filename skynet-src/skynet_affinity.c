@@ -0,0 +1,149 @@
+#include "skynet_affinity.h"
+
+#ifdef __linux__
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <sched.h>
+#include <pthread.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int
+skynet_cpuset_parse(struct skynet_cpuset *set, const char *str) {
+	set->n = 0;
+	const char *p = str;
+	while (*p) {
+		char *end;
+		long from = strtol(p, &end, 10);
+		if (end == p || from < 0)
+			return 1;
+		long to = from;
+		p = end;
+		if (*p == '-') {
+			++p;
+			to = strtol(p, &end, 10);
+			if (end == p || to < from)
+				return 1;
+			p = end;
+		}
+		long i;
+		for (i=from;i<=to;i++) {
+			if (set->n >= MAX_AFFINITY_CPU)
+				return 1;
+			set->cpu[set->n++] = (int)i;
+		}
+		while (*p == ',' || *p == ' ' || *p == '\n')
+			++p;
+	}
+	return set->n == 0;
+}
+
+#ifdef __linux__
+
+int
+skynet_cpuset_bind(const struct skynet_cpuset *set) {
+	cpu_set_t cpuset;
+	CPU_ZERO(&cpuset);
+	int i;
+	for (i=0;i<set->n;i++) {
+		if (set->cpu[i] >= CPU_SETSIZE)
+			return 1;
+		CPU_SET(set->cpu[i], &cpuset);
+	}
+	return pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+}
+
+// read a list such as "0-3,8" from the file
+static int
+read_list(const char *path, struct skynet_cpuset *set) {
+	char line[1024];
+	FILE *f = fopen(path, "r");
+	if (f == NULL)
+		return 1;
+	char *r = fgets(line, sizeof(line), f);
+	fclose(f);
+	if (r == NULL)
+		return 1;
+	return skynet_cpuset_parse(set, line);
+}
+
+static int
+read_nodeset(int node, struct skynet_cpuset *set) {
+	char path[64];
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+	return read_list(path, set);
+}
+
+int
+skynet_numa_nodes(int *node, int max) {
+	// the node ids are not always contiguous (the memory-less or offline nodes), such as "0,2"
+	struct skynet_cpuset set;
+	if (max <= 0)
+		return 0;
+	if (read_list("/sys/devices/system/node/online", &set)) {
+		node[0] = 0;
+		return 1;
+	}
+	int i;
+	for (i=0;i<set.n && i<max;i++) {
+		node[i] = set.cpu[i];
+	}
+	return i;
+}
+
+int
+skynet_numa_cpuset(int node, struct skynet_cpuset *set) {
+	return read_nodeset(node, set);
+}
+
+int
+skynet_numa_node(int cpu) {
+	struct skynet_cpuset set;
+	int node[MAX_NUMA_NODE];
+	int n = skynet_numa_nodes(node, MAX_NUMA_NODE);
+	int j;
+	for (j=0;j<n;j++) {
+		if (read_nodeset(node[j], &set))
+			continue;
+		int i;
+		for (i=0;i<set.n;i++) {
+			if (set.cpu[i] == cpu)
+				return node[j];
+		}
+	}
+	return 0;
+}
+
+#else
+
+// not supported (macOS has no api to bind thread to core)
+
+int
+skynet_cpuset_bind(const struct skynet_cpuset *set) {
+	return 1;
+}
+
+int
+skynet_numa_nodes(int *node, int max) {
+	if (max <= 0)
+		return 0;
+	node[0] = 0;
+	return 1;
+}
+
+int
+skynet_numa_cpuset(int node, struct skynet_cpuset *set) {
+	set->n = 0;
+	return 1;
+}
+
+int
+skynet_numa_node(int cpu) {
+	return 0;
+}
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef skynet_affinity_h
+#define skynet_affinity_h
+
+#define MAX_AFFINITY_CPU 256
+#define MAX_NUMA_NODE 64
+
+struct skynet_cpuset {
+	int n;
+	int cpu[MAX_AFFINITY_CPU];
+};
+
+// parse cpu list such as "0-3,8,10-11", return 0 for success
+int skynet_cpuset_parse(struct skynet_cpuset *set, const char *str);
+// bind current thread to the cpu set, return 0 for success
+int skynet_cpuset_bind(const struct skynet_cpuset *set);
+
+// the ids of the online numa nodes (they may be non-contiguous) in node[max], return the number (at least 1)
+int skynet_numa_nodes(int *node, int max);
+// cpus of the numa node, return 0 for success
+int skynet_numa_cpuset(int node, struct skynet_cpuset *set);
+// numa node of the cpu, 0 when unknown
+int skynet_numa_node(int cpu);
+
+#endif
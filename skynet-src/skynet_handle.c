@@ -2,71 +2,161 @@
 
 #include "skynet_handle.h"
 #include "skynet_server.h"
-#include "rwlock.h"
+#include "spinlock.h"
+#include "atomic.h"
 
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <sched.h>
 
 #define DEFAULT_SLOT_SIZE 4
 #define MAX_SLOT_SIZE 0x40000000
 
+/*
+	Readers (skynet_handle_grab, skynet_handle_findname) don't take any lock.
+
+	A reader increases its own counter before reading the slot (or name) table, and decreases it after.
+	Each thread has its own counter in a separate cache line, so readers don't share a contended cache line.
+
+	Writers are serialized by a spinlock. The slot and name tables are copy-on-write when they are resized,
+	and a writer waits a grace period (all the reader counters become 0 once) before it frees the old table,
+	the names removed, or releases the context retired. The grace period is waited out of the spinlock.
+ */
+
+#define MAX_READER 64
+#define CACHELINE_SIZE 64
+#define GRACE_SPIN 1024
+
 struct handle_name {
 	char * name;
 	uint32_t handle;
 };
 
+struct handle_slot {
+	int size;
+	struct skynet_context * ctx[];
+};
+
+struct handle_names {
+	int count;
+	struct handle_name name[];
+};
+
+struct handle_reader {
+	volatile int n;
+	char pad[CACHELINE_SIZE - sizeof(int)];
+};
+
 struct handle_storage {
-	struct rwlock lock;
+	struct handle_reader reader[MAX_READER];
+	int reader_index;
+
+	struct spinlock lock;
 
 	uint32_t harbor;
 	uint32_t handle_index;
-	int slot_size;
-	struct skynet_context ** slot;
-	
-	int name_cap;
-	int name_count;
-	struct handle_name *name;
+	struct handle_slot * volatile slot;
+	struct handle_names * volatile names;
 };
 
 static struct handle_storage *H = NULL;
 
+static __thread int READER = -1;
+
+static inline struct handle_reader *
+reader_enter(struct handle_storage *s) {
+	int id = READER;
+	if (id < 0) {
+		// more than MAX_READER threads share the counters, it's still correct.
+		id = READER = ATOM_FINC(&s->reader_index) % MAX_READER;
+	}
+	struct handle_reader *r = &s->reader[id];
+	ATOM_INC(&r->n);
+	return r;
+}
+
+static inline void
+reader_leave(struct handle_reader *r) {
+	ATOM_DEC(&r->n);
+}
+
+// wait until all the readers which may see the old table leave
+static void
+grace_wait(struct handle_storage *s) {
+	__sync_synchronize();
+	int i;
+	for (i=0;i<MAX_READER;i++) {
+		int spin = 0;
+		while (s->reader[i].n) {
+			if (++spin >= GRACE_SPIN) {
+				// the reader may be preempted, give up the cpu.
+				sched_yield();
+				spin = 0;
+			}
+			__sync_synchronize();
+		}
+	}
+}
+
+static struct handle_slot *
+slot_new(int size) {
+	struct handle_slot *slot = skynet_malloc(sizeof(*slot) + size * sizeof(struct skynet_context *));
+	slot->size = size;
+	memset(slot->ctx, 0, size * sizeof(struct skynet_context *));
+	return slot;
+}
+
+static struct handle_names *
+names_new(int count) {
+	struct handle_names *names = skynet_malloc(sizeof(*names) + count * sizeof(struct handle_name));
+	names->count = count;
+	return names;
+}
+
 uint32_t
 skynet_handle_register(struct skynet_context *ctx) {
 	struct handle_storage *s = H;
 
-	rwlock_wlock(&s->lock);
-	
+	SPIN_LOCK(s)
+
 	for (;;) {
 		int i;
+		struct handle_slot *slot = s->slot;
 		uint32_t handle = s->handle_index;
-		for (i=0;i<s->slot_size;i++,handle++) {
+		for (i=0;i<slot->size;i++,handle++) {
 			if (handle > HANDLE_MASK) {
 				// 0 is reserved
 				handle = 1;
 			}
-			int hash = handle & (s->slot_size-1);
-			if (s->slot[hash] == NULL) {
-				s->slot[hash] = ctx;
+			int hash = handle & (slot->size-1);
+			if (slot->ctx[hash] == NULL) {
+				slot->ctx[hash] = ctx;
 				s->handle_index = handle + 1;
 
-				rwlock_wunlock(&s->lock);
+				SPIN_UNLOCK(s)
 
 				handle |= s->harbor;
 				return handle;
 			}
 		}
-		assert((s->slot_size*2 - 1) <= HANDLE_MASK);
-		struct skynet_context ** new_slot = skynet_malloc(s->slot_size * 2 * sizeof(struct skynet_context *));
-		memset(new_slot, 0, s->slot_size * 2 * sizeof(struct skynet_context *));
-		for (i=0;i<s->slot_size;i++) {
-			int hash = skynet_context_handle(s->slot[i]) & (s->slot_size * 2 - 1);
-			assert(new_slot[hash] == NULL);
-			new_slot[hash] = s->slot[i];
+		assert((slot->size*2 - 1) <= HANDLE_MASK);
+		struct handle_slot * new_slot = slot_new(slot->size * 2);
+		for (i=0;i<slot->size;i++) {
+			int hash = skynet_context_handle(slot->ctx[i]) & (new_slot->size - 1);
+			assert(new_slot->ctx[hash] == NULL);
+			new_slot->ctx[hash] = slot->ctx[i];
 		}
-		skynet_free(s->slot);
+		// the readers must see the content of new_slot before the pointer
+		__sync_synchronize();
 		s->slot = new_slot;
-		s->slot_size *= 2;
+
+		SPIN_UNLOCK(s)
+
+		grace_wait(s);
+		skynet_free(slot);
+
+		SPIN_LOCK(s)
 	}
 }
 
@@ -74,35 +164,56 @@ int
 skynet_handle_retire(uint32_t handle) {
 	int ret = 0;
 	struct handle_storage *s = H;
+	struct handle_names *old_names = NULL;
 
-	rwlock_wlock(&s->lock);
+	SPIN_LOCK(s)
 
-	uint32_t hash = handle & (s->slot_size-1);
-	struct skynet_context * ctx = s->slot[hash];
+	struct handle_slot *slot = s->slot;
+	uint32_t hash = handle & (slot->size-1);
+	struct skynet_context * ctx = slot->ctx[hash];
 
 	if (ctx != NULL && skynet_context_handle(ctx) == handle) {
-		s->slot[hash] = NULL;
+		slot->ctx[hash] = NULL;
 		ret = 1;
+		struct handle_names *names = s->names;
 		int i;
-		int j=0, n=s->name_count;
+		int n = names->count;
 		for (i=0; i<n; ++i) {
-			if (s->name[i].handle == handle) {
-				skynet_free(s->name[i].name);
-				continue;
-			} else if (i!=j) {
-				s->name[j] = s->name[i];
+			if (names->name[i].handle == handle)
+				break;
+		}
+		if (i < n) {
+			struct handle_names *new_names = names_new(n);
+			int j=0;
+			for (i=0; i<n; ++i) {
+				if (names->name[i].handle != handle) {
+					new_names->name[j++] = names->name[i];
+				}
 			}
-			++j;
+			new_names->count = j;
+			__sync_synchronize();
+			s->names = new_names;
+			old_names = names;
 		}
-		s->name_count = j;
 	} else {
 		ctx = NULL;
 	}
 
-	rwlock_wunlock(&s->lock);
+	SPIN_UNLOCK(s)
 
 	if (ctx) {
-		// release ctx may call skynet_handle_* , so wunlock first.
+		// the readers may still hold the ctx (or names) without reference
+		grace_wait(s);
+		if (old_names) {
+			int i;
+			for (i=0; i<old_names->count; ++i) {
+				if (old_names->name[i].handle == handle) {
+					skynet_free(old_names->name[i].name);
+				}
+			}
+			skynet_free(old_names);
+		}
+		// release ctx may call skynet_handle_* , so unlock first.
 		skynet_context_release(ctx);
 	}
 
@@ -115,13 +226,18 @@ skynet_handle_retireall() {
 	for (;;) {
 		int n=0;
 		int i;
-		for (i=0;i<s->slot_size;i++) {
-			rwlock_rlock(&s->lock);
-			struct skynet_context * ctx = s->slot[i];
+		for (i=0;;i++) {
+			struct handle_reader *r = reader_enter(s);
+			struct handle_slot *slot = s->slot;
+			if (i >= slot->size) {
+				reader_leave(r);
+				break;
+			}
+			struct skynet_context * ctx = slot->ctx[i];
 			uint32_t handle = 0;
 			if (ctx)
 				handle = skynet_context_handle(ctx);
-			rwlock_runlock(&s->lock);
+			reader_leave(r);
 			if (handle != 0) {
 				if (skynet_handle_retire(handle)) {
 					++n;
@@ -138,16 +254,17 @@ skynet_handle_grab(uint32_t handle) {
 	struct handle_storage *s = H;
 	struct skynet_context * result = NULL;
 
-	rwlock_rlock(&s->lock);
+	struct handle_reader *r = reader_enter(s);
 
-	uint32_t hash = handle & (s->slot_size-1);
-	struct skynet_context * ctx = s->slot[hash];
+	struct handle_slot *slot = s->slot;
+	uint32_t hash = handle & (slot->size-1);
+	struct skynet_context * ctx = slot->ctx[hash];
 	if (ctx && skynet_context_handle(ctx) == handle) {
 		result = ctx;
 		skynet_context_grab(result);
 	}
 
-	rwlock_runlock(&s->lock);
+	reader_leave(r);
 
 	return result;
 }
@@ -156,15 +273,16 @@ uint32_t
 skynet_handle_findname(const char * name) {
 	struct handle_storage *s = H;
 
-	rwlock_rlock(&s->lock);
+	struct handle_reader *r = reader_enter(s);
 
+	struct handle_names *names = s->names;
 	uint32_t handle = 0;
 
 	int begin = 0;
-	int end = s->name_count - 1;
+	int end = names->count - 1;
 	while (begin<=end) {
 		int mid = (begin+end)/2;
-		struct handle_name *n = &s->name[mid];
+		struct handle_name *n = &names->name[mid];
 		int c = strcmp(n->name, name);
 		if (c==0) {
 			handle = n->handle;
@@ -177,44 +295,35 @@ skynet_handle_findname(const char * name) {
 		}
 	}
 
-	rwlock_runlock(&s->lock);
+	reader_leave(r);
 
 	return handle;
 }
 
-static void
-_insert_name_before(struct handle_storage *s, char *name, uint32_t handle, int before) {
-	if (s->name_count >= s->name_cap) {
-		s->name_cap *= 2;
-		assert(s->name_cap <= MAX_SLOT_SIZE);
-		struct handle_name * n = skynet_malloc(s->name_cap * sizeof(struct handle_name));
-		int i;
-		for (i=0;i<before;i++) {
-			n[i] = s->name[i];
-		}
-		for (i=before;i<s->name_count;i++) {
-			n[i+1] = s->name[i];
-		}
-		skynet_free(s->name);
-		s->name = n;
-	} else {
-		int i;
-		for (i=s->name_count;i>before;i--) {
-			s->name[i] = s->name[i-1];
-		}
+static struct handle_names *
+_insert_name_before(struct handle_names *names, char *name, uint32_t handle, int before) {
+	struct handle_names * n = names_new(names->count + 1);
+	int i;
+	for (i=0;i<before;i++) {
+		n->name[i] = names->name[i];
+	}
+	for (i=before;i<names->count;i++) {
+		n->name[i+1] = names->name[i];
 	}
-	s->name[before].name = name;
-	s->name[before].handle = handle;
-	s->name_count ++;
+	n->name[before].name = name;
+	n->name[before].handle = handle;
+	return n;
 }
 
+// *old is the old names table, free it after the grace period (out of the lock)
 static const char *
-_insert_name(struct handle_storage *s, const char * name, uint32_t handle) {
+_insert_name(struct handle_storage *s, const char * name, uint32_t handle, struct handle_names **old) {
+	struct handle_names *names = s->names;
 	int begin = 0;
-	int end = s->name_count - 1;
+	int end = names->count - 1;
 	while (begin<=end) {
 		int mid = (begin+end)/2;
-		struct handle_name *n = &s->name[mid];
+		struct handle_name *n = &names->name[mid];
 		int c = strcmp(n->name, name);
 		if (c==0) {
 			return NULL;
@@ -225,20 +334,31 @@ _insert_name(struct handle_storage *s, const char * name, uint32_t handle) {
 			end = mid - 1;
 		}
 	}
+	assert(names->count < MAX_SLOT_SIZE);
 	char * result = skynet_strdup(name);
 
-	_insert_name_before(s, result, handle, begin);
+	struct handle_names *new_names = _insert_name_before(names, result, handle, begin);
+	__sync_synchronize();
+	s->names = new_names;
+	*old = names;
 
 	return result;
 }
 
 const char * 
 skynet_handle_namehandle(uint32_t handle, const char *name) {
-	rwlock_wlock(&H->lock);
+	struct handle_names *old = NULL;
+
+	SPIN_LOCK(H)
 
-	const char * ret = _insert_name(H, name, handle);
+	const char * ret = _insert_name(H, name, handle, &old);
 
-	rwlock_wunlock(&H->lock);
+	SPIN_UNLOCK(H)
+
+	if (old) {
+		grace_wait(H);
+		skynet_free(old);
+	}
 
 	return ret;
 }
@@ -247,20 +367,16 @@ void
 skynet_handle_init(int harbor) {
 	assert(H==NULL);
 	struct handle_storage * s = skynet_malloc(sizeof(*H));
-	s->slot_size = DEFAULT_SLOT_SIZE;
-	s->slot = skynet_malloc(s->slot_size * sizeof(struct skynet_context *));
-	memset(s->slot, 0, s->slot_size * sizeof(struct skynet_context *));
+	memset(s, 0, sizeof(*s));
+	s->slot = slot_new(DEFAULT_SLOT_SIZE);
 
-	rwlock_init(&s->lock);
+	SPIN_INIT(s)
 	// reserve 0 for system
 	s->harbor = (uint32_t) (harbor & 0xff) << HANDLE_REMOTE_SHIFT;
 	s->handle_index = 1;
-	s->name_cap = 2;
-	s->name_count = 0;
-	s->name = skynet_malloc(s->name_cap * sizeof(struct handle_name));
+	s->names = names_new(0);
 
 	H = s;
 
 	// Don't need to free H
 }
-
@@ -10,6 +10,13 @@ struct skynet_config {
 	const char * bootstrap;
 	const char * logger;
 	const char * logservice;
+	const char * worker_idle;
+	const char * worker_cpu;
+	const char * socket_cpu;
+	int socket_thread;
+	const char * timer_cpu;
+	int numa;
+	int timer_tick;
 };
 
 #define THREAD_WORKER 0
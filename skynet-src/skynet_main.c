@@ -171,6 +171,13 @@ main(int argc, char *argv[]) {
 	config.logger = optstring("logger", NULL);
 	config.logservice = optstring("logservice", "logger");
 	config.profile = optboolean("profile", 1);
+	config.worker_idle = optstring("worker_idle", "hybrid");
+	config.worker_cpu = optstring("worker_cpu", NULL);
+	config.socket_cpu = optstring("socket_cpu", NULL);
+	config.socket_thread = optint("socket_thread", 1);
+	config.timer_cpu = optstring("timer_cpu", NULL);
+	config.numa = optboolean("numa", 0);
+	config.timer_tick = optint("timer_tick", 10);
 
 	lua_close(L);
 
@@ -2,6 +2,7 @@
 #define skynet_malloc_h
 
 #include <stddef.h>
+#include <stdint.h>
 
 #define skynet_malloc malloc
 #define skynet_calloc calloc
@@ -20,5 +21,16 @@ void * skynet_lalloc(void *ptr, size_t osize, size_t nsize);	// use for lua
 void * skynet_memalign(size_t alignment, size_t size);
 void * skynet_aligned_alloc(size_t alignment, size_t size);
 int skynet_posix_memalign(void **memptr, size_t alignment, size_t size);
+void * skynet_malloc_pooled(size_t sz);	// for the socket read buffer, free it by skynet_free
+// make the block (sz bytes from skynet_malloc) an immutable block with ref references, each skynet_free releases one.
+// It may move the block. Returns NULL (the block isn't changed) when it's not supported.
+void * skynet_shared(void *ptr, size_t sz, int ref);
+
+// the jemalloc arena for a lua state, shared > 0 picks one of the shared arenas. NULL when it's not supported
+struct skynet_arena;
+struct skynet_arena * skynet_arena_new(int shared);
+void skynet_arena_owner(struct skynet_arena *, uint32_t handle);	// for memory.info
+void skynet_arena_delete(struct skynet_arena *);
+void * skynet_arena_lalloc(struct skynet_arena *, void *ptr, size_t osize, size_t nsize);
 
 #endif
@@ -2,6 +2,7 @@
 #include "skynet_mq.h"
 #include "skynet_handle.h"
 #include "spinlock.h"
+#include "atomic.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -11,6 +12,15 @@
 
 #define DEFAULT_QUEUE_SIZE 64
 #define MAX_GLOBAL_MQ 0x10000
+#define GP(p) ((p) & (MAX_GLOBAL_MQ-1))
+
+// The global queue is a lock-free ring of message_queue by default.
+// Define USE_GLOBALMQ_SPINLOCK to use the old spinlocked linked list instead.
+#if defined(USE_PTHREAD_LOCK) && !defined(USE_GLOBALMQ_SPINLOCK)
+#define USE_GLOBALMQ_SPINLOCK
+#endif
+
+#define CACHELINE_SIZE 64
 
 // 0 means mq is not in global mq.
 // 1 means mq is in global mq , or the message is dispatching.
@@ -18,32 +28,58 @@
 #define MQ_IN_GLOBAL 1
 #define MQ_OVERLOAD 1024
 
+/*
+	The message queue of a service has many producers but only one consumer at a time (the worker which
+	gets it from the global queue), so it's a lock-free MPSC ring of MQ_RING_SIZE slots (the same sequence
+	scheme as the global queue).
+
+	When the ring is full, the queue switches to overflow mode : producers push messages into a growable
+	overflow queue protected by the spinlock, and the consumer takes them after the ring is empty. The
+	queue leaves overflow mode when the overflow queue is drained, so the order of messages is kept.
+ */
+
+#define MQ_RING_SIZE 64
+#define MP(p) ((p) & (MQ_RING_SIZE-1))
+
+struct mq_slot {
+	volatile uint32_t seq;
+	struct skynet_message msg;
+};
+
 struct message_queue {
-	struct spinlock lock;
+	// consumer side
+	uint32_t head;
 	uint32_t handle;
-	int cap;
-	int head;
-	int tail;
-	int release;
-	int in_global;
+	volatile int release;
+	volatile int in_global;
+	int priority;
 	int overload;
 	int overload_threshold;
-	struct skynet_message *queue;
 	struct message_queue *next;
+	char pad[CACHELINE_SIZE];
+	// producer side
+	volatile uint32_t tail;
+	volatile int overflow;
+	struct spinlock lock;
+	// overflow queue, allocated when it's needed
+	int cap;
+	int ohead;
+	int otail;
+	struct skynet_message *queue;
+	struct mq_slot slot[MQ_RING_SIZE];
 };
 
+#ifdef USE_GLOBALMQ_SPINLOCK
+
 struct global_queue {
 	struct message_queue *head;
 	struct message_queue *tail;
 	struct spinlock lock;
 };
 
-static struct global_queue *Q = NULL;
-
-void 
-skynet_globalmq_push(struct message_queue * queue) {
-	struct global_queue *q= Q;
 
+static void
+global_push(struct global_queue *q, struct message_queue * queue) {
 	SPIN_LOCK(q)
 	assert(queue->next == NULL);
 	if(q->tail) {
@@ -55,10 +91,8 @@ skynet_globalmq_push(struct message_queue * queue) {
 	SPIN_UNLOCK(q)
 }
 
-struct message_queue * 
-skynet_globalmq_pop() {
-	struct global_queue *q = Q;
-
+static struct message_queue *
+global_pop(struct global_queue *q) {
 	SPIN_LOCK(q)
 	struct message_queue *mq = q->head;
 	if(mq) {
@@ -74,23 +108,396 @@ skynet_globalmq_pop() {
 	return mq;
 }
 
+static int
+global_pending(struct global_queue *q) {
+	// approximate, only tell if it's empty
+	return q->head != NULL;
+}
+
+#else
+
+/*
+	A bounded MPMC ring (see Dmitry Vyukov's bounded queue) .
+
+	Each slot has a sequence number : slot[i].seq == pos means the slot is free for the producer at pos,
+	slot[i].seq == pos+1 means it's ready for the consumer at pos.
+
+	A message_queue is in the global queue at most once (guarded by in_global), so the ring can only be
+	full when there are more than MAX_GLOBAL_MQ services ready at the same time. In this rare case,
+	the queue goes to an overflow list protected by a spinlock.
+ */
+
+struct global_slot {
+	volatile uint32_t seq;
+	struct message_queue *mq;
+};
+
+struct global_queue {
+	volatile uint32_t head;
+	char pad_head[CACHELINE_SIZE - sizeof(uint32_t)];
+	volatile uint32_t tail;
+	char pad_tail[CACHELINE_SIZE - sizeof(uint32_t)];
+	struct message_queue * volatile list_head;
+	struct message_queue *list_tail;
+	struct spinlock lock;
+	struct global_slot slot[MAX_GLOBAL_MQ];
+};
+
+
+static int
+ring_push(struct global_queue *q, struct message_queue *mq) {
+	uint32_t pos = q->tail;
+	for (;;) {
+		struct global_slot *s = &q->slot[GP(pos)];
+		int32_t dif = (int32_t)(s->seq - pos);
+		if (dif == 0) {
+			if (ATOM_CAS(&q->tail, pos, pos+1)) {
+				s->mq = mq;
+				__sync_synchronize();
+				s->seq = pos + 1;
+				return 1;
+			}
+		} else if (dif < 0) {
+			// full
+			return 0;
+		}
+		pos = q->tail;
+	}
+}
+
+static struct message_queue *
+ring_pop(struct global_queue *q) {
+	uint32_t pos = q->head;
+	for (;;) {
+		struct global_slot *s = &q->slot[GP(pos)];
+		int32_t dif = (int32_t)(s->seq - (pos + 1));
+		if (dif == 0) {
+			if (ATOM_CAS(&q->head, pos, pos+1)) {
+				struct message_queue *mq = s->mq;
+				__sync_synchronize();
+				s->seq = pos + MAX_GLOBAL_MQ;
+				return mq;
+			}
+		} else if (dif < 0) {
+			// empty
+			return NULL;
+		}
+		pos = q->head;
+	}
+}
+
+static void
+global_push(struct global_queue *q, struct message_queue * queue) {
+	assert(queue->next == NULL);
+	if (ring_push(q, queue))
+		return;
+
+	SPIN_LOCK(q)
+	if(q->list_tail) {
+		q->list_tail->next = queue;
+		q->list_tail = queue;
+	} else {
+		q->list_head = q->list_tail = queue;
+	}
+	SPIN_UNLOCK(q)
+}
+
+static struct message_queue *
+global_pop(struct global_queue *q) {
+	if (q->list_head) {
+		SPIN_LOCK(q)
+		struct message_queue *mq = q->list_head;
+		if (mq) {
+			q->list_head = mq->next;
+			if (q->list_head == NULL) {
+				assert(mq == q->list_tail);
+				q->list_tail = NULL;
+			}
+			mq->next = NULL;
+		}
+		SPIN_UNLOCK(q)
+		if (mq)
+			return mq;
+	}
+
+	return ring_pop(q);
+}
+
+static int
+global_pending(struct global_queue *q) {
+	int n = (int)(q->tail - q->head);
+	if (n < 0)
+		n = 0;
+	if (q->list_head)
+		++n;
+	return n;
+}
+
+#endif
+
+/*
+	There is one global queue for each priority class (MQ_PRIORITY_*). Workers pick the classes in
+	weighted-fair order (high 4 : normal 3 : low 1 in CLASS_PICK), and fall back to other classes when
+	the preferred one is empty.
+
+	Services throttled by cpu budget are kept in a throttled list, and pushed back by
+	skynet_globalmq_unthrottle at the next time slice.
+ */
+
+static struct global_queue *Q[MQ_PRIORITY_MAX];
+
+static const int CLASS_PICK[8] = {
+	MQ_PRIORITY_HIGH, MQ_PRIORITY_NORMAL, MQ_PRIORITY_HIGH, MQ_PRIORITY_NORMAL,
+	MQ_PRIORITY_HIGH, MQ_PRIORITY_NORMAL, MQ_PRIORITY_HIGH, MQ_PRIORITY_LOW,
+};
+
+static __thread unsigned PICK = 0;
+
+struct throttled_queue {
+	struct spinlock lock;
+	struct message_queue * volatile head;
+	uint32_t slice;
+};
+
+static struct throttled_queue THROTTLED;
+
+/*
+	Each worker thread owns a local run queue. When a worker makes a queue ready (skynet_globalmq_push),
+	the queue goes to its own local queue first, so the service is likely dispatched by the same core later.
+	Other threads (socket, timer, etc) use the global queue.
+
+	A worker pops from its local queue first, but checks the global queue every GLOBAL_CHECK_INTERVAL pops
+	to avoid starving it. When both are empty, it steals half of the local queue of another worker.
+
+	A message_queue is still in only one run queue at a time (guarded by in_global), so the order of
+	messages in one service is not changed.
+ */
+
+#define LOCAL_QUEUE_SIZE 256
+#define LQ(p) ((p) & (LOCAL_QUEUE_SIZE-1))
+#define GLOBAL_CHECK_INTERVAL 61
+
+struct local_queue {
+	struct spinlock lock;
+	volatile int head;
+	volatile int tail;
+	int tick;
+	int id;
+	struct message_queue *queue[LOCAL_QUEUE_SIZE];
+	char pad[CACHELINE_SIZE];
+};
+
+static struct local_queue *LQ_SET = NULL;
+static int LQ_COUNT = 0;
+static __thread struct local_queue *LOCAL = NULL;
+
+static int
+local_push(struct local_queue *lq, struct message_queue *queue) {
+	int ret = 0;
+	SPIN_LOCK(lq)
+	if (lq->tail - lq->head < LOCAL_QUEUE_SIZE) {
+		lq->queue[LQ(lq->tail)] = queue;
+		++lq->tail;
+		ret = 1;
+	}
+	SPIN_UNLOCK(lq)
+	return ret;
+}
+
+static struct message_queue *
+local_pop(struct local_queue *lq) {
+	if (lq->head == lq->tail)
+		return NULL;
+	struct message_queue *mq = NULL;
+	SPIN_LOCK(lq)
+	if (lq->head != lq->tail) {
+		mq = lq->queue[LQ(lq->head)];
+		++lq->head;
+	}
+	SPIN_UNLOCK(lq)
+	return mq;
+}
+
+static struct message_queue *
+local_steal(struct local_queue *lq) {
+	struct message_queue *steal[LOCAL_QUEUE_SIZE/2];
+	int i;
+	for (i=1;i<LQ_COUNT;i++) {
+		struct local_queue *victim = &LQ_SET[(lq->id + i) % LQ_COUNT];
+		int n = victim->tail - victim->head;
+		if (n <= 0)
+			continue;
+		if (!spinlock_trylock(&victim->lock))
+			continue;
+		// steal half (at least one)
+		n = (victim->tail - victim->head + 1) / 2;
+		int j;
+		for (j=0;j<n;j++) {
+			steal[j] = victim->queue[LQ(victim->head)];
+			++victim->head;
+		}
+		SPIN_UNLOCK(victim)
+		if (n == 0)
+			continue;
+		for (j=1;j<n;j++) {
+			if (!local_push(lq, steal[j])) {
+				global_push(Q[MQ_PRIORITY_NORMAL], steal[j]);
+			}
+		}
+		return steal[0];
+	}
+	return NULL;
+}
+
+void 
+skynet_globalmq_push(struct message_queue * queue) {
+	int priority = queue->priority;
+	if (priority == MQ_PRIORITY_NORMAL) {
+		// only normal class uses local queues, the others should be seen by all workers.
+		struct local_queue *lq = LOCAL;
+		if (lq && local_push(lq, queue))
+			return;
+	}
+	global_push(Q[priority], queue);
+}
+
+static struct message_queue *
+normal_pop(void) {
+	struct global_queue *gq = Q[MQ_PRIORITY_NORMAL];
+	struct local_queue *lq = LOCAL;
+	if (lq == NULL)
+		return global_pop(gq);
+	struct message_queue *mq;
+	if (++lq->tick >= GLOBAL_CHECK_INTERVAL) {
+		lq->tick = 0;
+		mq = global_pop(gq);
+		if (mq)
+			return mq;
+	}
+	mq = local_pop(lq);
+	if (mq)
+		return mq;
+	mq = global_pop(gq);
+	if (mq)
+		return mq;
+	return local_steal(lq);
+}
+
+static inline struct message_queue *
+class_pop(int priority) {
+	if (priority == MQ_PRIORITY_NORMAL)
+		return normal_pop();
+	return global_pop(Q[priority]);
+}
+
+struct message_queue * 
+skynet_globalmq_pop() {
+	int first = CLASS_PICK[PICK++ % (sizeof(CLASS_PICK)/sizeof(CLASS_PICK[0]))];
+	struct message_queue *mq = class_pop(first);
+	if (mq)
+		return mq;
+	int i;
+	for (i=0;i<MQ_PRIORITY_MAX;i++) {
+		if (i != first) {
+			mq = class_pop(i);
+			if (mq)
+				return mq;
+		}
+	}
+	return NULL;
+}
+
+void
+skynet_globalmq_throttle(struct message_queue *queue) {
+	struct throttled_queue *t = &THROTTLED;
+	assert(queue->next == NULL);
+	SPIN_LOCK(t)
+	queue->next = t->head;
+	t->head = queue;
+	SPIN_UNLOCK(t)
+}
+
+void
+skynet_globalmq_unthrottle(uint32_t slice) {
+	struct throttled_queue *t = &THROTTLED;
+	if (t->slice == slice)
+		return;
+	t->slice = slice;
+	if (t->head == NULL)
+		return;
+	SPIN_LOCK(t)
+	struct message_queue *mq = t->head;
+	t->head = NULL;
+	SPIN_UNLOCK(t)
+	while (mq) {
+		struct message_queue *next = mq->next;
+		mq->next = NULL;
+		global_push(Q[mq->priority], mq);
+		mq = next;
+	}
+}
+
+void
+skynet_localmq_init(int n) {
+	assert(LQ_SET == NULL);
+	struct local_queue *lq = skynet_malloc(n * sizeof(*lq));
+	memset(lq, 0, n * sizeof(*lq));
+	int i;
+	for (i=0;i<n;i++) {
+		SPIN_INIT(&lq[i])
+		lq[i].id = i;
+	}
+	LQ_SET = lq;
+	LQ_COUNT = n;
+}
+
+void
+skynet_localmq_bind(int id) {
+	assert(id >= 0 && id < LQ_COUNT);
+	LOCAL = &LQ_SET[id];
+}
+
+int
+skynet_globalmq_pending(void) {
+	int i;
+	int n = 0;
+	for (i=0;i<MQ_PRIORITY_MAX;i++) {
+		n += global_pending(Q[i]);
+	}
+	// the local queue of a busy worker (its handler may run for a long time) can be stolen by the others.
+	for (i=0;i<LQ_COUNT;i++) {
+		struct local_queue *lq = &LQ_SET[i];
+		int len = lq->tail - lq->head;
+		if (len > 0)
+			n += len;
+	}
+	return n;
+}
+
+int
+skynet_localmq_length(void) {
+	struct local_queue *lq = LOCAL;
+	if (lq == NULL)
+		return 0;
+	return lq->tail - lq->head;
+}
+
 struct message_queue * 
 skynet_mq_create(uint32_t handle) {
 	struct message_queue *q = skynet_malloc(sizeof(*q));
+	memset(q, 0, sizeof(*q));
 	q->handle = handle;
-	q->cap = DEFAULT_QUEUE_SIZE;
-	q->head = 0;
-	q->tail = 0;
 	SPIN_INIT(q)
 	// When the queue is create (always between service create and service init) ,
 	// set in_global flag to avoid push it to global queue .
 	// If the service init success, skynet_context_new will call skynet_mq_push to push it to global queue.
 	q->in_global = MQ_IN_GLOBAL;
-	q->release = 0;
-	q->overload = 0;
+	q->priority = MQ_PRIORITY_NORMAL;
 	q->overload_threshold = MQ_OVERLOAD;
-	q->queue = skynet_malloc(sizeof(struct skynet_message) * q->cap);
-	q->next = NULL;
+	int i;
+	for (i=0;i<MQ_RING_SIZE;i++) {
+		q->slot[i].seq = i;
+	}
 
 	return q;
 }
@@ -109,19 +516,35 @@ skynet_mq_handle(struct message_queue *q) {
 }
 
 int
-skynet_mq_length(struct message_queue *q) {
-	int head, tail,cap;
+skynet_mq_priority(struct message_queue *q, int priority) {
+	if (priority >= 0 && priority < MQ_PRIORITY_MAX) {
+		// takes effect when the queue is pushed into run queue next time
+		q->priority = priority;
+	}
+	return q->priority;
+}
 
-	SPIN_LOCK(q)
-	head = q->head;
-	tail = q->tail;
-	cap = q->cap;
-	SPIN_UNLOCK(q)
-	
-	if (head <= tail) {
-		return tail - head;
+static int
+overflow_length(struct message_queue *q) {
+	int len = q->otail - q->ohead;
+	if (len < 0) {
+		len += q->cap;
+	}
+	return len;
+}
+
+int
+skynet_mq_length(struct message_queue *q) {
+	int len = (int)(q->tail - q->head);
+	if (len < 0) {
+		len = 0;
+	}
+	if (q->overflow) {
+		SPIN_LOCK(q)
+		len += overflow_length(q);
+		SPIN_UNLOCK(q)
 	}
-	return tail + cap - head;
+	return len;
 }
 
 int
@@ -134,41 +557,49 @@ skynet_mq_overload(struct message_queue *q) {
 	return 0;
 }
 
-int
-skynet_mq_pop(struct message_queue *q, struct skynet_message *message) {
-	int ret = 1;
-	SPIN_LOCK(q)
-
-	if (q->head != q->tail) {
-		*message = q->queue[q->head++];
-		ret = 0;
-		int head = q->head;
-		int tail = q->tail;
-		int cap = q->cap;
-
-		if (head >= cap) {
-			q->head = head = 0;
-		}
-		int length = tail - head;
-		if (length < 0) {
-			length += cap;
+static int
+ring_push_message(struct message_queue *q, struct skynet_message *message) {
+	uint32_t pos = q->tail;
+	for (;;) {
+		struct mq_slot *s = &q->slot[MP(pos)];
+		int32_t dif = (int32_t)(s->seq - pos);
+		if (dif == 0) {
+			if (ATOM_CAS(&q->tail, pos, pos+1)) {
+				s->msg = *message;
+				__sync_synchronize();
+				s->seq = pos + 1;
+				return 1;
+			}
+		} else if (dif < 0) {
+			// full
+			return 0;
 		}
-		while (length > q->overload_threshold) {
-			q->overload = length;
-			q->overload_threshold *= 2;
-		}
-	} else {
-		// reset overload_threshold when queue is empty
-		q->overload_threshold = MQ_OVERLOAD;
+		pos = q->tail;
 	}
+}
 
-	if (ret) {
-		q->in_global = 0;
+// only the consumer calls it
+static int
+ring_pop_message(struct message_queue *q, struct skynet_message *msgs, int n) {
+	uint32_t pos = q->head;
+	int i;
+	for (i=0;i<n;i++) {
+		if (q->slot[MP(pos+i)].seq != pos + i + 1)
+			break;
 	}
-	
-	SPIN_UNLOCK(q)
-
-	return ret;
+	if (i == 0)
+		return 0;
+	__sync_synchronize();
+	int j;
+	for (j=0;j<i;j++) {
+		msgs[j] = q->slot[MP(pos+j)].msg;
+	}
+	__sync_synchronize();
+	for (j=0;j<i;j++) {
+		q->slot[MP(pos+j)].seq = pos + j + MQ_RING_SIZE;
+	}
+	q->head = pos + i;
+	return i;
 }
 
 static void
@@ -176,55 +607,149 @@ expand_queue(struct message_queue *q) {
 	struct skynet_message *new_queue = skynet_malloc(sizeof(struct skynet_message) * q->cap * 2);
 	int i;
 	for (i=0;i<q->cap;i++) {
-		new_queue[i] = q->queue[(q->head + i) % q->cap];
+		new_queue[i] = q->queue[(q->ohead + i) % q->cap];
 	}
-	q->head = 0;
-	q->tail = q->cap;
+	q->ohead = 0;
+	q->otail = q->cap;
 	q->cap *= 2;
 	
 	skynet_free(q->queue);
 	q->queue = new_queue;
 }
 
-void 
-skynet_mq_push(struct message_queue *q, struct skynet_message *message) {
-	assert(message);
+static void
+overflow_push(struct message_queue *q, struct skynet_message *message) {
+	if (q->queue == NULL) {
+		q->cap = DEFAULT_QUEUE_SIZE;
+		q->queue = skynet_malloc(sizeof(struct skynet_message) * q->cap);
+	}
+	q->queue[q->otail] = *message;
+	if (++ q->otail >= q->cap) {
+		q->otail = 0;
+	}
+
+	if (q->ohead == q->otail) {
+		expand_queue(q);
+	}
+}
+
+static int
+overflow_pop(struct message_queue *q, struct skynet_message *msgs, int n) {
+	int i = 0;
 	SPIN_LOCK(q)
+	while (i < n && q->ohead != q->otail) {
+		msgs[i++] = q->queue[q->ohead++];
+		if (q->ohead >= q->cap) {
+			q->ohead = 0;
+		}
+	}
+	if (q->ohead == q->otail) {
+		// drained, producers can use the ring again
+		q->overflow = 0;
+	}
+	SPIN_UNLOCK(q)
+	return i;
+}
 
-	q->queue[q->tail] = *message;
-	if (++ q->tail >= q->cap) {
-		q->tail = 0;
+static void
+check_overload(struct message_queue *q) {
+	int length = skynet_mq_length(q);
+	while (length > q->overload_threshold) {
+		q->overload = length;
+		q->overload_threshold *= 2;
 	}
+}
 
-	if (q->head == q->tail) {
-		expand_queue(q);
+int
+skynet_mq_pop_batch(struct message_queue *q, struct skynet_message *msgs, int n) {
+	for (;;) {
+		int c = ring_pop_message(q, msgs, n);
+		if (c == 0 && q->overflow) {
+			c = overflow_pop(q, msgs, n);
+		}
+		if (c > 0) {
+			check_overload(q);
+			return c;
+		}
+		// reset overload_threshold when queue is empty
+		q->overload_threshold = MQ_OVERLOAD;
+		q->in_global = 0;
+		__sync_synchronize();
+		// A producer may push a message before it sees in_global == 0, take the queue back in this case.
+		if (q->slot[MP(q->head)].seq != q->head + 1 && !q->overflow)
+			return 0;
+		if (!ATOM_CAS(&q->in_global, 0, MQ_IN_GLOBAL)) {
+			// the producer has pushed the queue into global mq
+			return 0;
+		}
+	}
+}
+
+int
+skynet_mq_pop(struct message_queue *q, struct skynet_message *message) {
+	return skynet_mq_pop_batch(q, message, 1) ? 0 : 1;
+}
+
+static inline void
+push_message(struct message_queue *q, struct skynet_message *message) {
+	if (q->overflow || !ring_push_message(q, message)) {
+		SPIN_LOCK(q)
+		q->overflow = 1;
+		overflow_push(q, message);
+		SPIN_UNLOCK(q)
 	}
+}
 
-	if (q->in_global == 0) {
-		q->in_global = MQ_IN_GLOBAL;
+static inline void
+schedule(struct message_queue *q) {
+	// pair with the __sync_synchronize in skynet_mq_pop_batch
+	__sync_synchronize();
+	if (q->in_global == 0 && ATOM_CAS(&q->in_global, 0, MQ_IN_GLOBAL)) {
 		skynet_globalmq_push(q);
 	}
-	
-	SPIN_UNLOCK(q)
+}
+
+void 
+skynet_mq_push(struct message_queue *q, struct skynet_message *message) {
+	assert(message);
+	push_message(q, message);
+	schedule(q);
+}
+
+void
+skynet_mq_push_batch(struct message_queue *q, struct skynet_message *msgs, int n) {
+	int i;
+	for (i=0;i<n;i++) {
+		push_message(q, &msgs[i]);
+	}
+	schedule(q);
 }
 
 void 
 skynet_mq_init() {
-	struct global_queue *q = skynet_malloc(sizeof(*q));
-	memset(q,0,sizeof(*q));
-	SPIN_INIT(q);
-	Q=q;
+	int p;
+	for (p=0;p<MQ_PRIORITY_MAX;p++) {
+		struct global_queue *q = skynet_malloc(sizeof(*q));
+		memset(q,0,sizeof(*q));
+		SPIN_INIT(q);
+#ifndef USE_GLOBALMQ_SPINLOCK
+		int i;
+		for (i=0;i<MAX_GLOBAL_MQ;i++) {
+			q->slot[i].seq = i;
+		}
+#endif
+		Q[p]=q;
+	}
+	SPIN_INIT(&THROTTLED);
 }
 
 void 
 skynet_mq_mark_release(struct message_queue *q) {
-	SPIN_LOCK(q)
 	assert(q->release == 0);
 	q->release = 1;
-	if (q->in_global != MQ_IN_GLOBAL) {
+	if (ATOM_CAS(&q->in_global, 0, MQ_IN_GLOBAL)) {
 		skynet_globalmq_push(q);
 	}
-	SPIN_UNLOCK(q)
 }
 
 static void
@@ -238,13 +763,11 @@ _drop_queue(struct message_queue *q, message_drop drop_func, void *ud) {
 
 void 
 skynet_mq_release(struct message_queue *q, message_drop drop_func, void *ud) {
-	SPIN_LOCK(q)
-	
+	// the caller owns the queue (in_global == MQ_IN_GLOBAL)
+	__sync_synchronize();
 	if (q->release) {
-		SPIN_UNLOCK(q)
 		_drop_queue(q, drop_func, ud);
 	} else {
 		skynet_globalmq_push(q);
-		SPIN_UNLOCK(q)
 	}
 }
@@ -15,10 +15,26 @@ struct skynet_message {
 #define MESSAGE_TYPE_MASK (SIZE_MAX >> 8)
 #define MESSAGE_TYPE_SHIFT ((sizeof(size_t)-1) * 8)
 
+// priority classes, each has its own run queue
+#define MQ_PRIORITY_HIGH 0
+#define MQ_PRIORITY_NORMAL 1
+#define MQ_PRIORITY_LOW 2
+#define MQ_PRIORITY_MAX 3
+
 struct message_queue;
 
 void skynet_globalmq_push(struct message_queue * queue);
 struct message_queue * skynet_globalmq_pop(void);
+// approximate number of ready queues in global mq and all the local queues
+int skynet_globalmq_pending(void);
+// keep the queue (owned by caller) out of run queue until the time slice changes
+void skynet_globalmq_throttle(struct message_queue * queue);
+void skynet_globalmq_unthrottle(uint32_t slice);
+
+// local run queue for each worker thread
+void skynet_localmq_init(int n);
+void skynet_localmq_bind(int id);
+int skynet_localmq_length(void);
 
 struct message_queue * skynet_mq_create(uint32_t handle);
 void skynet_mq_mark_release(struct message_queue *q);
@@ -27,10 +43,15 @@ typedef void (*message_drop)(struct skynet_message *, void *);
 
 void skynet_mq_release(struct message_queue *q, message_drop drop_func, void *ud);
 uint32_t skynet_mq_handle(struct message_queue *);
+// set priority class (MQ_PRIORITY_*) if it's valid, return current priority class
+int skynet_mq_priority(struct message_queue *q, int priority);
 
 // 0 for success
 int skynet_mq_pop(struct message_queue *q, struct skynet_message *message);
+// pop at most n messages, return the number of messages. 0 means the queue is empty (and leaves global mq)
+int skynet_mq_pop_batch(struct message_queue *q, struct skynet_message *msgs, int n);
 void skynet_mq_push(struct message_queue *q, struct skynet_message *message);
+void skynet_mq_push_batch(struct message_queue *q, struct skynet_message *msgs, int n);
 
 // return the length of message queue, for debug
 int skynet_mq_length(struct message_queue *q);
@@ -40,6 +40,9 @@
 
 #endif
 
+// max messages popped from the service queue at once
+#define MESSAGE_BATCH 16
+
 struct skynet_context {
 	void * instance;
 	struct skynet_module * mod;
@@ -49,6 +52,9 @@ struct skynet_context {
 	FILE * logfile;
 	uint64_t cpu_cost;	// in microsec
 	uint64_t cpu_start;	// in microsec
+	uint64_t budget_used;	// cpu time used in current slice, in microsec
+	uint32_t budget_slice;
+	int cpu_budget;	// cpu time per slice (SKYNET_CPU_SLICE), in microsec. 0 means unlimited
 	char result[32];
 	uint32_t handle;
 	int session_id;
@@ -148,6 +154,9 @@ skynet_context_new(const char * name, const char *param) {
 
 	ctx->cpu_cost = 0;
 	ctx->cpu_start = 0;
+	ctx->budget_used = 0;
+	ctx->budget_slice = 0;
+	ctx->cpu_budget = 0;
 	ctx->message_count = 0;
 	ctx->profile = G_NODE.profile;
 	// Should set to 0 first to avoid skynet_handle_retireall get an uninitialized handle
@@ -238,6 +247,30 @@ skynet_context_push(uint32_t handle, struct skynet_message *message) {
 	return 0;
 }
 
+int
+skynet_context_mqlen(uint32_t handle) {
+	struct skynet_context * ctx = skynet_handle_grab(handle);
+	if (ctx == NULL) {
+		return -1;
+	}
+	int len = skynet_mq_length(ctx->queue);
+	skynet_context_release(ctx);
+
+	return len;
+}
+
+int
+skynet_context_push_batch(uint32_t handle, struct skynet_message *msgs, int n) {
+	struct skynet_context * ctx = skynet_handle_grab(handle);
+	if (ctx == NULL) {
+		return -1;
+	}
+	skynet_mq_push_batch(ctx->queue, msgs, n);
+	skynet_context_release(ctx);
+
+	return 0;
+}
+
 void 
 skynet_context_endless(uint32_t handle) {
 	struct skynet_context * ctx = skynet_handle_grab(handle);
@@ -293,6 +326,19 @@ skynet_context_dispatchall(struct skynet_context * ctx) {
 	}
 }
 
+static bool
+cpu_budget_exceed(struct skynet_context *ctx, uint64_t *start) {
+	uint64_t now = skynet_thread_time();
+	uint32_t slice = (uint32_t)(skynet_now() / SKYNET_CPU_SLICE);
+	if (ctx->budget_slice != slice) {
+		ctx->budget_slice = slice;
+		ctx->budget_used = 0;
+	}
+	ctx->budget_used += now - *start;
+	*start = now;
+	return ctx->budget_used >= (uint64_t)ctx->cpu_budget;
+}
+
 struct message_queue * 
 skynet_context_message_dispatch(struct skynet_monitor *sm, struct message_queue *q, int weight) {
 	if (q == NULL) {
@@ -311,30 +357,53 @@ skynet_context_message_dispatch(struct skynet_monitor *sm, struct message_queue
 	}
 
 	int i,n=1;
-	struct skynet_message msg;
+	struct skynet_message msgs[MESSAGE_BATCH];
+	uint64_t budget_start = 0;
+	if (ctx->cpu_budget > 0) {
+		budget_start = skynet_thread_time();
+	}
 
-	for (i=0;i<n;i++) {
-		if (skynet_mq_pop(q,&msg)) {
+	if (weight >= 0) {
+		// dispatch 1/(2^weight) of the messages in queue (at least 1)
+		n = skynet_mq_length(q) >> weight;
+		if (n < 1)
+			n = 1;
+	}
+
+	for (i=0;i<n;) {
+		int batch = n - i;
+		if (batch > MESSAGE_BATCH)
+			batch = MESSAGE_BATCH;
+		batch = skynet_mq_pop_batch(q, msgs, batch);
+		if (batch == 0) {
 			skynet_context_release(ctx);
 			return skynet_globalmq_pop();
-		} else if (i==0 && weight >= 0) {
-			n = skynet_mq_length(q);
-			n >>= weight;
 		}
 		int overload = skynet_mq_overload(q);
 		if (overload) {
 			skynet_error(ctx, "May overload, message queue length = %d", overload);
 		}
 
-		skynet_monitor_trigger(sm, msg.source , handle);
+		int j;
+		for (j=0;j<batch;j++) {
+			struct skynet_message *msg = &msgs[j];
+			skynet_monitor_trigger(sm, msg->source , handle);
 
-		if (ctx->cb == NULL) {
-			skynet_free(msg.data);
-		} else {
-			dispatch_message(ctx, &msg);
-		}
+			if (ctx->cb == NULL) {
+				skynet_free(msg->data);
+			} else {
+				dispatch_message(ctx, msg);
+			}
 
-		skynet_monitor_trigger(sm, 0,0);
+			skynet_monitor_trigger(sm, 0,0);
+		}
+		i += batch;
+		if (budget_start && cpu_budget_exceed(ctx, &budget_start)) {
+			// out of cpu budget, the queue is kept out of run queue until next slice
+			skynet_globalmq_throttle(q);
+			skynet_context_release(ctx);
+			return skynet_globalmq_pop();
+		}
 	}
 
 	assert(q == ctx->queue);
@@ -404,6 +473,26 @@ cmd_timeout(struct skynet_context * context, const char * param) {
 	return context->result;
 }
 
+static const char *
+cmd_timeoutms(struct skynet_context * context, const char * param) {
+	char * session_ptr = NULL;
+	int ms = strtol(param, &session_ptr, 10);
+	int session = skynet_context_newsession(context);
+	skynet_timeout_ms(context->handle, ms, session);
+	sprintf(context->result, "%d", session);
+	return context->result;
+}
+
+static const char *
+cmd_canceltimeout(struct skynet_context * context, const char * param) {
+	char * session_ptr = NULL;
+	int session = strtol(param, &session_ptr, 10);
+	if (session_ptr == param)
+		return NULL;
+	sprintf(context->result, "%d", skynet_timeout_cancel(context->handle, session));
+	return context->result;
+}
+
 static const char *
 cmd_reg(struct skynet_context * context, const char * param) {
 	if (param == NULL || param[0] == '\0') {
@@ -642,8 +731,37 @@ cmd_signal(struct skynet_context * context, const char * param) {
 	return NULL;
 }
 
+static const char * PRIORITY_NAME[MQ_PRIORITY_MAX] = { "high", "normal", "low" };
+
+// PRIORITY [high|normal|low] [cpu budget in microsec per slice]
+static const char *
+cmd_priority(struct skynet_context * context, const char * param) {
+	int priority = -1;
+	if (param && param[0]) {
+		int i;
+		for (i=0;i<MQ_PRIORITY_MAX;i++) {
+			size_t sz = strlen(PRIORITY_NAME[i]);
+			if (strncmp(param, PRIORITY_NAME[i], sz) == 0 && (param[sz] == ' ' || param[sz] == '\0')) {
+				priority = i;
+				break;
+			}
+		}
+		if (priority < 0)
+			return NULL;
+		param = strchr(param, ' ');
+		if (param) {
+			context->cpu_budget = strtol(param, NULL, 10);
+		}
+	}
+	priority = skynet_mq_priority(context->queue, priority);
+	strcpy(context->result, PRIORITY_NAME[priority]);
+	return context->result;
+}
+
 static struct command_func cmd_funcs[] = {
 	{ "TIMEOUT", cmd_timeout },
+	{ "TIMEOUTMS", cmd_timeoutms },
+	{ "CANCELTIMEOUT", cmd_canceltimeout },
 	{ "REG", cmd_reg },
 	{ "QUERY", cmd_query },
 	{ "NAME", cmd_name },
@@ -659,6 +777,7 @@ static struct command_func cmd_funcs[] = {
 	{ "LOGON", cmd_logon },
 	{ "LOGOFF", cmd_logoff },
 	{ "SIGNAL", cmd_signal },
+	{ "PRIORITY", cmd_priority },
 	{ NULL, NULL },
 };
 
@@ -742,6 +861,38 @@ skynet_send(struct skynet_context * context, uint32_t source, uint32_t destinati
 	return session;
 }
 
+int
+skynet_send_shared(struct skynet_context * context, uint32_t source, const uint32_t * destination, int n, int type, void * data, size_t sz) {
+	if (n <= 0) {
+		skynet_free(data);
+		return 0;
+	}
+	type = (type & 0xff) | PTYPE_TAG_DONTCOPY;
+	void * shared = NULL;
+	if (n > 1) {
+		shared = skynet_shared(data, sz, n);
+	}
+	int i;
+	int err = 0;
+	for (i=0;i<n;i++) {
+		void * msg = shared;
+		if (msg == NULL) {
+			// not shared (without jemalloc), copy it for the destinations but the last one.
+			if (i == n-1) {
+				msg = data;
+			} else {
+				msg = skynet_malloc(sz);
+				memcpy(msg, data, sz);
+			}
+		}
+		// the reference is released by skynet_send when it fails
+		if (skynet_send(context, source, destination[i], type, 0, msg, sz) < 0) {
+			++err;
+		}
+	}
+	return err;
+}
+
 int
 skynet_sendname(struct skynet_context * context, uint32_t source, const char * addr , int type, int session, void * data, size_t sz) {
 	if (source == 0) {
@@ -4,6 +4,9 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+// time slice for cpu budget, in 1/100 sec
+#define SKYNET_CPU_SLICE 10
+
 struct skynet_context;
 struct skynet_message;
 struct skynet_monitor;
@@ -14,6 +17,8 @@ void skynet_context_reserve(struct skynet_context *ctx);
 struct skynet_context * skynet_context_release(struct skynet_context *);
 uint32_t skynet_context_handle(struct skynet_context *);
 int skynet_context_push(uint32_t handle, struct skynet_message *message);
+int skynet_context_push_batch(uint32_t handle, struct skynet_message *msgs, int n);
+int skynet_context_mqlen(uint32_t handle);	// -1 when the context is gone
 void skynet_context_send(struct skynet_context * context, void * msg, size_t sz, uint32_t source, int type, int session);
 int skynet_context_newsession(struct skynet_context *);
 struct message_queue * skynet_context_message_dispatch(struct skynet_monitor *, struct message_queue *, int weight);	// return next queue
@@ -5,38 +5,182 @@
 #include "skynet_server.h"
 #include "skynet_mq.h"
 #include "skynet_harbor.h"
+#include "atomic.h"
+#include "spinlock.h"
 
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
-static struct socket_server * SOCKET_SERVER = NULL;
+/*
+	The sockets are sharded across SOCKET_COUNT socket servers, each one is polled by its own socket thread.
+	A new socket (listen, connect, bind, udp) goes to the servers in turn, and the others find their server by id.
+ */
+static struct socket_server ** SOCKET_SERVER = NULL;
+static int SOCKET_COUNT = 0;
+static int SOCKET_NEXT = 0;
+
+/*
+	A socket stops reading when the message queue of its service is longer than PAUSE_MQ_LENGTH,
+	so the tcp backpressure reaches the peer. The timer thread resumes it when the queue is shorter than RESUME_MQ_LENGTH.
+ */
+#define PAUSE_MQ_LENGTH 1024
+#define RESUME_MQ_LENGTH 256
+#define MAX_RESUME 64
+
+struct paused_socket {
+	int id;
+	uint32_t handle;
+};
+
+// one for each socket server
+struct pause_list {
+	struct spinlock lock;
+	int n;
+	int cap;
+	struct paused_socket *s;
+};
+
+static struct pause_list * PAUSED = NULL;
+
+static inline struct socket_server *
+get_server(int id) {
+	return SOCKET_SERVER[socket_server_shard(id, SOCKET_COUNT)];
+}
+
+static inline struct socket_server *
+next_server() {
+	unsigned n = (unsigned)ATOM_FINC(&SOCKET_NEXT);
+	return SOCKET_SERVER[n % SOCKET_COUNT];
+}
 
 void 
-skynet_socket_init() {
-	SOCKET_SERVER = socket_server_create(skynet_now());
+skynet_socket_init(int n) {
+	if (n < 1) {
+		n = 1;
+	}
+	SOCKET_SERVER = skynet_malloc(n * sizeof(struct socket_server *));
+	PAUSED = skynet_malloc(n * sizeof(struct pause_list));
+	SOCKET_COUNT = n;
+	int i;
+	for (i=0;i<n;i++) {
+		SOCKET_SERVER[i] = socket_server_create(skynet_now());
+		struct pause_list *pl = &PAUSED[i];
+		SPIN_INIT(pl)
+		pl->n = 0;
+		pl->cap = 0;
+		pl->s = NULL;
+	}
+	socket_server_group(SOCKET_SERVER, n);
 }
 
 void
 skynet_socket_exit() {
-	socket_server_exit(SOCKET_SERVER);
+	int i;
+	for (i=0;i<SOCKET_COUNT;i++) {
+		socket_server_exit(SOCKET_SERVER[i]);
+	}
 }
 
 void
 skynet_socket_free() {
-	socket_server_release(SOCKET_SERVER);
+	int i;
+	for (i=0;i<SOCKET_COUNT;i++) {
+		socket_server_release(SOCKET_SERVER[i]);
+		struct pause_list *pl = &PAUSED[i];
+		SPIN_DESTROY(pl)
+		skynet_free(pl->s);
+	}
+	skynet_free(SOCKET_SERVER);
+	skynet_free(PAUSED);
 	SOCKET_SERVER = NULL;
+	PAUSED = NULL;
+	SOCKET_COUNT = 0;
+}
+
+// socket thread
+static void
+check_overload(int index, int id, uint32_t handle) {
+	if (skynet_context_mqlen(handle) < PAUSE_MQ_LENGTH)
+		return;
+	if (!socket_server_pause_local(SOCKET_SERVER[index], id, SOCKET_PAUSE_QUEUE))
+		return;
+	struct pause_list *pl = &PAUSED[index];
+	SPIN_LOCK(pl)
+	if (pl->n >= pl->cap) {
+		pl->cap = pl->cap == 0 ? 16 : pl->cap * 2;
+		pl->s = skynet_realloc(pl->s, pl->cap * sizeof(struct paused_socket));
+	}
+	pl->s[pl->n].id = id;
+	pl->s[pl->n].handle = handle;
+	++pl->n;
+	SPIN_UNLOCK(pl)
+}
+
+// timer thread
+static void
+resume_sockets(int index) {
+	struct pause_list *pl = &PAUSED[index];
+	if (pl->n == 0)
+		return;
+	int resume[MAX_RESUME];
+	int n = 0;
+	SPIN_LOCK(pl)
+	int i = 0;
+	while (i < pl->n && n < MAX_RESUME) {
+		struct paused_socket *p = &pl->s[i];
+		// mqlen is -1 when the service is gone
+		if (skynet_context_mqlen(p->handle) < RESUME_MQ_LENGTH) {
+			resume[n++] = p->id;
+			*p = pl->s[--pl->n];
+		} else {
+			++i;
+		}
+	}
+	SPIN_UNLOCK(pl)
+	for (i=0;i<n;i++) {
+		socket_server_resume(SOCKET_SERVER[index], resume[i], SOCKET_PAUSE_QUEUE);
+	}
 }
 
 void
 skynet_socket_updatetime() {
-	socket_server_updatetime(SOCKET_SERVER, skynet_now());
+	uint64_t now = skynet_now();
+	int i;
+	for (i=0;i<SOCKET_COUNT;i++) {
+		socket_server_updatetime(SOCKET_SERVER[i], now);
+		resume_sockets(i);
+	}
 }
 
+/*
+	The socket thread handles all the events of one sp_wait (at most SOCKET_BATCH messages) before it pushes them.
+	The messages to the same service are pushed together (one schedule of its queue), and the workers are waked up once for the batch.
+ */
+#define SOCKET_BATCH 64
+
+struct socket_event {
+	uint32_t handle;
+	int index;
+	int id;
+	bool overload;	// check the queue length of the service after push
+	struct skynet_message message;
+};
+
+struct socket_batch {
+	int n;
+	struct socket_event ev[SOCKET_BATCH];
+};
+
 // mainloop thread
 static void
-forward_message(int type, bool padding, struct socket_message * result) {
+forward_message(struct socket_batch *b, int type, bool padding, struct socket_message * result, bool overload) {
 	struct skynet_socket_message *sm;
 	size_t sz = sizeof(*sm);
 	if (padding) {
@@ -61,126 +205,236 @@ forward_message(int type, bool padding, struct socket_message * result) {
 		sm->buffer = result->data;
 	}
 
-	struct skynet_message message;
-	message.source = 0;
-	message.session = 0;
-	message.data = sm;
-	message.sz = sz | ((size_t)PTYPE_SOCKET << MESSAGE_TYPE_SHIFT);
-	
-	if (skynet_context_push((uint32_t)result->opaque, &message)) {
-		// todo: report somewhere to close socket
-		// don't call skynet_socket_close here (It will block mainloop)
-		skynet_free(sm->buffer);
-		skynet_free(sm);
+	struct socket_event *ev = &b->ev[b->n];
+	ev->handle = (uint32_t)result->opaque;
+	ev->index = b->n;
+	ev->id = result->id;
+	ev->overload = overload;
+	struct skynet_message *message = &ev->message;
+	message->source = 0;
+	message->session = 0;
+	message->data = sm;
+	message->sz = sz | ((size_t)PTYPE_SOCKET << MESSAGE_TYPE_SHIFT);
+	++b->n;
+}
+
+static int
+compare_event(const void *a, const void *b) {
+	const struct socket_event *ea = a;
+	const struct socket_event *eb = b;
+	if (ea->handle != eb->handle)
+		return ea->handle < eb->handle ? -1 : 1;
+	return ea->index - eb->index;
+}
+
+// push the messages of the same destination together (keep the order of each destination)
+static void
+flush_batch(int index, struct socket_batch *b) {
+	int n = b->n;
+	if (n == 0)
+		return;
+	qsort(b->ev, n, sizeof(b->ev[0]), compare_event);
+	struct skynet_message message[SOCKET_BATCH];
+	int i = 0;
+	while (i < n) {
+		int from = i;
+		uint32_t handle = b->ev[i].handle;
+		int c = 0;
+		do {
+			message[c++] = b->ev[i].message;
+			++i;
+		} while (i < n && b->ev[i].handle == handle);
+		if (skynet_context_push_batch(handle, message, c)) {
+			// todo: report somewhere to close socket
+			// don't call skynet_socket_close here (It will block mainloop)
+			int j;
+			for (j=0;j<c;j++) {
+				struct skynet_socket_message *sm = message[j].data;
+				skynet_free(sm->buffer);
+				skynet_free(sm);
+			}
+			continue;
+		}
+		int j;
+		for (j=from;j<i;j++) {
+			if (b->ev[j].overload) {
+				check_overload(index, b->ev[j].id, handle);
+			}
+		}
 	}
+	b->n = 0;
 }
 
 int 
-skynet_socket_poll() {
-	struct socket_server *ss = SOCKET_SERVER;
+skynet_socket_poll(int index) {
+	assert(index < SOCKET_COUNT);
+	struct socket_server *ss = SOCKET_SERVER[index];
 	assert(ss);
+	struct socket_batch b;
+	b.n = 0;
 	struct socket_message result;
 	int more = 1;
-	int type = socket_server_poll(ss, &result, &more);
-	switch (type) {
-	case SOCKET_EXIT:
-		return 0;
-	case SOCKET_DATA:
-		forward_message(SKYNET_SOCKET_TYPE_DATA, false, &result);
-		break;
-	case SOCKET_CLOSE:
-		forward_message(SKYNET_SOCKET_TYPE_CLOSE, false, &result);
-		break;
-	case SOCKET_OPEN:
-		forward_message(SKYNET_SOCKET_TYPE_CONNECT, true, &result);
-		break;
-	case SOCKET_ERR:
-		forward_message(SKYNET_SOCKET_TYPE_ERROR, true, &result);
-		break;
-	case SOCKET_ACCEPT:
-		forward_message(SKYNET_SOCKET_TYPE_ACCEPT, true, &result);
-		break;
-	case SOCKET_UDP:
-		forward_message(SKYNET_SOCKET_TYPE_UDP, false, &result);
-		break;
-	case SOCKET_WARNING:
-		forward_message(SKYNET_SOCKET_TYPE_WARNING, false, &result);
-		break;
-	default:
-		skynet_error(NULL, "Unknown socket message type %d.",type);
-		return -1;
-	}
-	if (more) {
-		return -1;
+	for (;;) {
+		int type = socket_server_poll(ss, &result, &more);
+		// wait at most once for a batch
+		more = 0;
+		switch (type) {
+		case SOCKET_EXIT:
+			flush_batch(index, &b);
+			return 0;
+		case SOCKET_IDLE:
+			flush_batch(index, &b);
+			return 1;
+		case SOCKET_DATA:
+			forward_message(&b, SKYNET_SOCKET_TYPE_DATA, false, &result, true);
+			break;
+		case SOCKET_CLOSE:
+			forward_message(&b, SKYNET_SOCKET_TYPE_CLOSE, false, &result, false);
+			break;
+		case SOCKET_OPEN:
+			forward_message(&b, SKYNET_SOCKET_TYPE_CONNECT, true, &result, false);
+			break;
+		case SOCKET_ERR:
+			forward_message(&b, SKYNET_SOCKET_TYPE_ERROR, true, &result, false);
+			break;
+		case SOCKET_ACCEPT:
+			forward_message(&b, SKYNET_SOCKET_TYPE_ACCEPT, true, &result, false);
+			break;
+		case SOCKET_UDP:
+			forward_message(&b, SKYNET_SOCKET_TYPE_UDP, false, &result, true);
+			break;
+		case SOCKET_WARNING:
+			forward_message(&b, SKYNET_SOCKET_TYPE_WARNING, false, &result, false);
+			break;
+		case SOCKET_UDP_BATCH:
+			forward_message(&b, SKYNET_SOCKET_TYPE_UDP_BATCH, false, &result, true);
+			break;
+		default:
+			flush_batch(index, &b);
+			skynet_error(NULL, "Unknown socket message type %d.",type);
+			return -1;
+		}
+		if (b.n >= SOCKET_BATCH) {
+			// the rest events are handled by the next poll
+			flush_batch(index, &b);
+			return 1;
+		}
 	}
-	return 1;
 }
 
 int
 skynet_socket_send(struct skynet_context *ctx, int id, void *buffer, int sz) {
-	return socket_server_send(SOCKET_SERVER, id, buffer, sz);
+	return socket_server_send(get_server(id), id, buffer, sz);
 }
 
 int
 skynet_socket_send_lowpriority(struct skynet_context *ctx, int id, void *buffer, int sz) {
-	return socket_server_send_lowpriority(SOCKET_SERVER, id, buffer, sz);
+	return socket_server_send_lowpriority(get_server(id), id, buffer, sz);
+}
+
+int
+skynet_socket_sendfile(struct skynet_context *ctx, int id, const char *filename, int64_t offset, int64_t sz) {
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		skynet_error(ctx, "sendfile %s failed : %s", filename, strerror(errno));
+		return -1;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || offset < 0 || offset > st.st_size) {
+		skynet_error(ctx, "sendfile %s failed : invalid offset %lld", filename, (long long)offset);
+		close(fd);
+		return -1;
+	}
+	if (sz < 0 || sz > st.st_size - offset) {
+		sz = st.st_size - offset;
+	}
+	if (sz > INT_MAX) {
+		skynet_error(ctx, "sendfile %s failed : %lld bytes is too large, send it in parts", filename, (long long)sz);
+		close(fd);
+		return -1;
+	}
+	if (sz == 0) {
+		close(fd);
+		return 0;
+	}
+	return socket_server_sendfile(get_server(id), id, fd, offset, (int)sz);
 }
 
 int 
 skynet_socket_listen(struct skynet_context *ctx, const char *host, int port, int backlog) {
 	uint32_t source = skynet_context_handle(ctx);
-	return socket_server_listen(SOCKET_SERVER, source, host, port, backlog);
+	return socket_server_listen(next_server(), source, host, port, backlog);
 }
 
 int 
 skynet_socket_connect(struct skynet_context *ctx, const char *host, int port) {
 	uint32_t source = skynet_context_handle(ctx);
-	return socket_server_connect(SOCKET_SERVER, source, host, port);
+	return socket_server_connect(next_server(), source, host, port);
 }
 
 int 
 skynet_socket_bind(struct skynet_context *ctx, int fd) {
 	uint32_t source = skynet_context_handle(ctx);
-	return socket_server_bind(SOCKET_SERVER, source, fd);
+	return socket_server_bind(next_server(), source, fd);
 }
 
 void 
 skynet_socket_close(struct skynet_context *ctx, int id) {
 	uint32_t source = skynet_context_handle(ctx);
-	socket_server_close(SOCKET_SERVER, source, id);
+	socket_server_close(get_server(id), source, id);
 }
 
 void 
 skynet_socket_shutdown(struct skynet_context *ctx, int id) {
 	uint32_t source = skynet_context_handle(ctx);
-	socket_server_shutdown(SOCKET_SERVER, source, id);
+	socket_server_shutdown(get_server(id), source, id);
 }
 
 void 
 skynet_socket_start(struct skynet_context *ctx, int id) {
 	uint32_t source = skynet_context_handle(ctx);
-	socket_server_start(SOCKET_SERVER, source, id);
+	socket_server_start(get_server(id), source, id);
 }
 
 void
 skynet_socket_nodelay(struct skynet_context *ctx, int id) {
-	socket_server_nodelay(SOCKET_SERVER, id);
+	socket_server_nodelay(get_server(id), id);
+}
+
+void
+skynet_socket_pause(struct skynet_context *ctx, int id) {
+	socket_server_pause(get_server(id), id, SOCKET_PAUSE_USER);
+}
+
+void
+skynet_socket_resume(struct skynet_context *ctx, int id) {
+	socket_server_resume(get_server(id), id, SOCKET_PAUSE_USER);
+}
+
+void
+skynet_socket_zerocopy(struct skynet_context *ctx, int id) {
+	socket_server_zerocopy(get_server(id), id);
 }
 
 int 
 skynet_socket_udp(struct skynet_context *ctx, const char * addr, int port) {
 	uint32_t source = skynet_context_handle(ctx);
-	return socket_server_udp(SOCKET_SERVER, source, addr, port);
+	return socket_server_udp(next_server(), source, addr, port);
 }
 
 int 
 skynet_socket_udp_connect(struct skynet_context *ctx, int id, const char * addr, int port) {
-	return socket_server_udp_connect(SOCKET_SERVER, id, addr, port);
+	return socket_server_udp_connect(get_server(id), id, addr, port);
+}
+
+void
+skynet_socket_udp_batch(struct skynet_context *ctx, int id, int enable) {
+	socket_server_udp_batch(get_server(id), id, enable);
 }
 
 int 
 skynet_socket_udp_send(struct skynet_context *ctx, int id, const char * address, const void *buffer, int sz) {
-	return socket_server_udp_send(SOCKET_SERVER, id, (const struct socket_udp_address *)address, buffer, sz);
+	return socket_server_udp_send(get_server(id), id, (const struct socket_udp_address *)address, buffer, sz);
 }
 
 const char *
@@ -193,10 +447,23 @@ skynet_socket_udp_address(struct skynet_socket_message *msg, int *addrsz) {
 	sm.opaque = 0;
 	sm.ud = msg->ud;
 	sm.data = msg->buffer;
-	return (const char *)socket_server_udp_address(SOCKET_SERVER, &sm, addrsz);
+	return (const char *)socket_server_udp_address(get_server(sm.id), &sm, addrsz);
 }
 
 struct socket_info *
 skynet_socket_info() {
-	return socket_server_info(SOCKET_SERVER);
+	struct socket_info *si = NULL;
+	int i;
+	for (i=SOCKET_COUNT-1;i>=0;i--) {
+		struct socket_info *list = socket_server_info(SOCKET_SERVER[i]);
+		if (list) {
+			struct socket_info *tail = list;
+			while (tail->next) {
+				tail = tail->next;
+			}
+			tail->next = si;
+			si = list;
+		}
+	}
+	return si;
 }
@@ -1,6 +1,8 @@
 #ifndef skynet_socket_h
 #define skynet_socket_h
 
+#include <stdint.h>
+
 #include "socket_info.h"
 
 struct skynet_context;
@@ -12,6 +14,7 @@ struct skynet_context;
 #define SKYNET_SOCKET_TYPE_ERROR 5
 #define SKYNET_SOCKET_TYPE_UDP 6
 #define SKYNET_SOCKET_TYPE_WARNING 7
+#define SKYNET_SOCKET_TYPE_UDP_BATCH 8
 
 struct skynet_socket_message {
 	int type;
@@ -20,14 +23,16 @@ struct skynet_socket_message {
 	char * buffer;
 };
 
-void skynet_socket_init();
+void skynet_socket_init(int n);
 void skynet_socket_exit();
 void skynet_socket_free();
-int skynet_socket_poll();
+int skynet_socket_poll(int index);
 void skynet_socket_updatetime();
 
 int skynet_socket_send(struct skynet_context *ctx, int id, void *buffer, int sz);
 int skynet_socket_send_lowpriority(struct skynet_context *ctx, int id, void *buffer, int sz);
+// send the file from offset, sz < 0 means to the end of file
+int skynet_socket_sendfile(struct skynet_context *ctx, int id, const char *filename, int64_t offset, int64_t sz);
 int skynet_socket_listen(struct skynet_context *ctx, const char *host, int port, int backlog);
 int skynet_socket_connect(struct skynet_context *ctx, const char *host, int port);
 int skynet_socket_bind(struct skynet_context *ctx, int fd);
@@ -35,9 +40,14 @@ void skynet_socket_close(struct skynet_context *ctx, int id);
 void skynet_socket_shutdown(struct skynet_context *ctx, int id);
 void skynet_socket_start(struct skynet_context *ctx, int id);
 void skynet_socket_nodelay(struct skynet_context *ctx, int id);
+void skynet_socket_zerocopy(struct skynet_context *ctx, int id);
+// stop / restart reading the socket, see socket_server_pause
+void skynet_socket_pause(struct skynet_context *ctx, int id);
+void skynet_socket_resume(struct skynet_context *ctx, int id);
 
 int skynet_socket_udp(struct skynet_context *ctx, const char * addr, int port);
 int skynet_socket_udp_connect(struct skynet_context *ctx, int id, const char * addr, int port);
+void skynet_socket_udp_batch(struct skynet_context *ctx, int id, int enable);
 int skynet_socket_udp_send(struct skynet_context *ctx, int id, const char * address, const void *buffer, int sz);
 const char * skynet_socket_udp_address(struct skynet_socket_message *, int *addrsz);
 
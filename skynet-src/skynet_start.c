@@ -9,6 +9,10 @@
 #include "skynet_socket.h"
 #include "skynet_daemon.h"
 #include "skynet_harbor.h"
+#include "skynet_affinity.h"
+#include "malloc_hook.h"
+#include "parker.h"
+#include "atomic.h"
 
 #include <pthread.h>
 #include <unistd.h>
@@ -17,20 +21,46 @@
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
+#include <sched.h>
+
+// What an idle worker does when there is no message queue to dispatch.
+// spin : yield and retry, never sleep. Lowest latency, burns cpu when idle.
+// park : sleep on its own parker at once, woken up by who makes queues ready.
+// hybrid : spin WORKER_SPIN times, and then park.
+#define IDLE_SPIN 0
+#define IDLE_PARK 1
+#define IDLE_HYBRID 2
+
+#define WORKER_SPIN 128
+
+struct worker_idle {
+	struct parker p;
+	volatile int parked;
+	char pad[64];
+};
 
 struct monitor {
 	int count;
 	struct skynet_monitor ** m;
-	pthread_cond_t cond;
-	pthread_mutex_t mutex;
-	int sleep;
-	int quit;
+	struct worker_idle * idle;
+	int mode;
+	volatile int sleep;
+	volatile int quit;
+	struct skynet_cpuset socket_cpu;
+	struct skynet_cpuset timer_cpu;
 };
 
 struct worker_parm {
 	struct monitor *m;
 	int id;
 	int weight;
+	int node;	// numa node, -1 for none
+	struct skynet_cpuset cpu;
+};
+
+struct socket_parm {
+	struct monitor *m;
+	int index;
 };
 
 static int SIG = 0;
@@ -52,27 +82,102 @@ create_thread(pthread_t *thread, void *(*start_routine) (void *), void *arg) {
 	}
 }
 
+// wakeup at most n parked workers
+static void
+wakeup(struct monitor *m, int n) {
+	// pair with the ATOM_INC in worker_park, either we see the sleeper, or it sees the ready queue.
+	__sync_synchronize();
+	if (m->sleep == 0)
+		return;
+	int i;
+	for (i=0;i<m->count && n > 0;i++) {
+		struct worker_idle *w = &m->idle[i];
+		if (w->parked && ATOM_CAS(&w->parked, 1, 0)) {
+			ATOM_DEC(&m->sleep);
+			parker_unpark(&w->p);
+			--n;
+		}
+	}
+}
+
+static void
+worker_park(struct monitor *m, int id) {
+	struct worker_idle *w = &m->idle[id];
+	w->parked = 1;
+	ATOM_INC(&m->sleep);
+	// check again, because a queue may become ready before we registered as parked
+	if (m->quit || skynet_globalmq_pending() > 0 || skynet_localmq_length() > 0) {
+		if (ATOM_CAS(&w->parked, 1, 0)) {
+			ATOM_DEC(&m->sleep);
+			return;
+		}
+		// someone else has unparked us, the permit will be consumed below.
+	}
+	parker_park(&w->p);
+}
+
+static void
+bind_cpu(struct skynet_cpuset *set, const char *name) {
+	if (set->n > 0 && skynet_cpuset_bind(set)) {
+		fprintf(stderr, "Bind %s thread to cpu failed\n", name);
+	}
+}
+
+static void
+parse_cpu(struct skynet_cpuset *set, const char *name, const char *str) {
+	set->n = 0;
+	if (str && skynet_cpuset_parse(set, str)) {
+		fprintf(stderr, "Invalid %s : %s\n", name, str);
+		exit(1);
+	}
+}
+
+// Pin workers to worker_cpu one by one (round robin), and/or group them by numa node.
 static void
-wakeup(struct monitor *m, int busy) {
-	if (m->sleep >= m->count - busy) {
-		// signal sleep worker, "spurious wakeup" is harmless
-		pthread_cond_signal(&m->cond);
+worker_placement(struct worker_parm *wp, int thread, struct skynet_config *config) {
+	struct skynet_cpuset cpus;
+	parse_cpu(&cpus, "worker_cpu", config->worker_cpu);
+	int node[MAX_NUMA_NODE];
+	int nodes = config->numa ? skynet_numa_nodes(node, MAX_NUMA_NODE) : 0;
+	int i;
+	for (i=0;i<thread;i++) {
+		wp[i].node = -1;
+		wp[i].cpu.n = 0;
+		if (cpus.n > 0) {
+			int cpu = cpus.cpu[i % cpus.n];
+			wp[i].cpu.n = 1;
+			wp[i].cpu.cpu[0] = cpu;
+			if (nodes > 0) {
+				wp[i].node = skynet_numa_node(cpu);
+			}
+		} else if (nodes > 0) {
+			// contiguous workers share one node
+			int id = node[i * nodes / thread];
+			wp[i].node = id;
+			skynet_numa_cpuset(id, &wp[i].cpu);
+		}
 	}
 }
 
 static void *
 thread_socket(void *p) {
-	struct monitor * m = p;
+	struct socket_parm *sp = p;
+	struct monitor * m = sp->m;
 	skynet_initthread(THREAD_SOCKET);
+	bind_cpu(&m->socket_cpu, "socket");
 	for (;;) {
-		int r = skynet_socket_poll();
+		int r = skynet_socket_poll(sp->index);
 		if (r==0)
 			break;
 		if (r<0) {
 			CHECK_ABORT
 			continue;
 		}
-		wakeup(m,0);
+		// wakeup once for a batch of socket messages
+		int pending = skynet_globalmq_pending();
+		if (pending > 0) {
+			wakeup(m, pending);
+		}
 	}
 	return NULL;
 }
@@ -83,9 +188,9 @@ free_monitor(struct monitor *m) {
 	int n = m->count;
 	for (i=0;i<n;i++) {
 		skynet_monitor_delete(m->m[i]);
+		parker_destroy(&m->idle[i].p);
 	}
-	pthread_mutex_destroy(&m->mutex);
-	pthread_cond_destroy(&m->cond);
+	skynet_free(m->idle);
 	skynet_free(m->m);
 	skynet_free(m);
 }
@@ -96,6 +201,8 @@ thread_monitor(void *p) {
 	int i;
 	int n = m->count;
 	skynet_initthread(THREAD_MONITOR);
+	// monitor thread sleeps most of the time, put it with the timer thread
+	bind_cpu(&m->timer_cpu, "monitor");
 	for (;;) {
 		CHECK_ABORT
 		for (i=0;i<n;i++) {
@@ -129,12 +236,16 @@ static void *
 thread_timer(void *p) {
 	struct monitor * m = p;
 	skynet_initthread(THREAD_TIMER);
+	bind_cpu(&m->timer_cpu, "timer");
 	for (;;) {
 		skynet_updatetime();
 		skynet_socket_updatetime();
 		CHECK_ABORT
-		wakeup(m,m->count-1);
-		usleep(2500);
+		// release the services throttled by cpu budget when a new slice begins
+		skynet_globalmq_unthrottle((uint32_t)(skynet_now() / SKYNET_CPU_SLICE));
+		// wakeup as many workers as the ready queues, including the ones in the local queues of busy workers
+		wakeup(m, skynet_globalmq_pending());
+		skynet_timer_sleep();
 		if (SIG) {
 			signal_hup();
 			SIG = 0;
@@ -143,10 +254,13 @@ thread_timer(void *p) {
 	// wakeup socket thread
 	skynet_socket_exit();
 	// wakeup all worker thread
-	pthread_mutex_lock(&m->mutex);
 	m->quit = 1;
-	pthread_cond_broadcast(&m->cond);
-	pthread_mutex_unlock(&m->mutex);
+	__sync_synchronize();
+	int i;
+	for (i=0;i<m->count;i++) {
+		m->idle[i].parked = 0;
+		parker_unpark(&m->idle[i].p);
+	}
 	return NULL;
 }
 
@@ -158,53 +272,84 @@ thread_worker(void *p) {
 	struct monitor *m = wp->m;
 	struct skynet_monitor *sm = m->m[id];
 	skynet_initthread(THREAD_WORKER);
+	bind_cpu(&wp->cpu, "worker");
+	if (wp->node >= 0) {
+		// the memory allocated by this worker (including the services it creates) comes from its node
+		skynet_malloc_bindnode(wp->node);
+	}
+	skynet_localmq_bind(id);
+	int spin_limit = m->mode == IDLE_HYBRID ? WORKER_SPIN : 0;
+	int spin = 0;
 	struct message_queue * q = NULL;
 	while (!m->quit) {
 		q = skynet_context_message_dispatch(sm, q, weight);
-		if (q == NULL) {
-			if (pthread_mutex_lock(&m->mutex) == 0) {
-				++ m->sleep;
-				// "spurious wakeup" is harmless,
-				// because skynet_context_message_dispatch() can be call at any time.
-				if (!m->quit)
-					pthread_cond_wait(&m->cond, &m->mutex);
-				-- m->sleep;
-				if (pthread_mutex_unlock(&m->mutex)) {
-					fprintf(stderr, "unlock mutex error");
-					exit(1);
-				}
+		if (q != NULL) {
+			spin = 0;
+			// local queue has more work than this thread can do, let a sleeping worker steal it
+			if (m->sleep > 0 && skynet_localmq_length() > 1) {
+				wakeup(m, 1);
 			}
+		} else if (spin < spin_limit) {
+			++spin;
+			sched_yield();
+		} else if (m->mode == IDLE_SPIN) {
+			// spin forever, don't count
+			sched_yield();
+		} else {
+			spin = 0;
+			// "spurious wakeup" is harmless,
+			// because skynet_context_message_dispatch() can be call at any time.
+			worker_park(m, id);
 		}
 	}
 	return NULL;
 }
 
+static int
+idle_mode(const char *mode) {
+	if (mode == NULL || strcmp(mode, "hybrid") == 0)
+		return IDLE_HYBRID;
+	if (strcmp(mode, "park") == 0)
+		return IDLE_PARK;
+	if (strcmp(mode, "spin") == 0)
+		return IDLE_SPIN;
+	fprintf(stderr, "Invalid worker_idle mode %s (spin|park|hybrid)\n", mode);
+	exit(1);
+}
+
 static void
-start(int thread) {
-	pthread_t pid[thread+3];
+start(struct skynet_config *config) {
+	int thread = config->thread;
+	int socket_thread = config->socket_thread;
+	pthread_t pid[thread+2+socket_thread];
 
 	struct monitor *m = skynet_malloc(sizeof(*m));
 	memset(m, 0, sizeof(*m));
 	m->count = thread;
 	m->sleep = 0;
+	m->mode = idle_mode(config->worker_idle);
+	parse_cpu(&m->socket_cpu, "socket_cpu", config->socket_cpu);
+	parse_cpu(&m->timer_cpu, "timer_cpu", config->timer_cpu);
 
 	m->m = skynet_malloc(thread * sizeof(struct skynet_monitor *));
 	int i;
+	m->idle = skynet_malloc(thread * sizeof(struct worker_idle));
+	memset(m->idle, 0, thread * sizeof(struct worker_idle));
 	for (i=0;i<thread;i++) {
 		m->m[i] = skynet_monitor_new();
+		parker_init(&m->idle[i].p);
 	}
-	if (pthread_mutex_init(&m->mutex, NULL)) {
-		fprintf(stderr, "Init mutex error");
-		exit(1);
-	}
-	if (pthread_cond_init(&m->cond, NULL)) {
-		fprintf(stderr, "Init cond error");
-		exit(1);
-	}
+
+	skynet_localmq_init(thread);
 
 	create_thread(&pid[0], thread_monitor, m);
 	create_thread(&pid[1], thread_timer, m);
-	create_thread(&pid[2], thread_socket, m);
+	struct socket_parm sp[socket_thread];
+	for (i=0;i<socket_thread;i++) {
+		sp[i].m = m;
+		sp[i].index = i;
+		create_thread(&pid[2+i], thread_socket, &sp[i]);
+	}
 
 	static int weight[] = { 
 		-1, -1, -1, -1, 0, 0, 0, 0,
@@ -212,6 +357,7 @@ start(int thread) {
 		2, 2, 2, 2, 2, 2, 2, 2, 
 		3, 3, 3, 3, 3, 3, 3, 3, };
 	struct worker_parm wp[thread];
+	worker_placement(wp, thread, config);
 	for (i=0;i<thread;i++) {
 		wp[i].m = m;
 		wp[i].id = i;
@@ -220,10 +366,10 @@ start(int thread) {
 		} else {
 			wp[i].weight = 0;
 		}
-		create_thread(&pid[i+3], thread_worker, &wp[i]);
+		create_thread(&pid[i+2+socket_thread], thread_worker, &wp[i]);
 	}
 
-	for (i=0;i<thread+3;i++) {
+	for (i=0;i<thread+2+socket_thread;i++) {
 		pthread_join(pid[i], NULL); 
 	}
 
@@ -262,8 +408,11 @@ skynet_start(struct skynet_config * config) {
 	skynet_handle_init(config->harbor);
 	skynet_mq_init();
 	skynet_module_init(config->module_path);
-	skynet_timer_init();
-	skynet_socket_init();
+	skynet_timer_init(config->timer_tick);
+	if (config->socket_thread < 1) {
+		config->socket_thread = 1;
+	}
+	skynet_socket_init(config->socket_thread);
 	skynet_profile_enable(config->profile);
 
 	struct skynet_context *ctx = skynet_context_new(config->logservice, config->logger);
@@ -276,7 +425,7 @@ skynet_start(struct skynet_config * config) {
 
 	bootstrap(ctx, config->bootstrap);
 
-	start(config->thread);
+	start(config);
 
 	// harbor_exit may call socket send, so it should exit before socket_free
 	skynet_harbor_exit();
@@ -11,6 +11,11 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/timerfd.h>
+#endif
 
 #if defined(__APPLE__)
 #include <AvailabilityMacros.h>
@@ -19,7 +24,13 @@
 #include <mach/mach.h>
 #endif
 
-typedef void (*timer_execute_func)(void *ud,void *arg);
+/*
+	Timers are sharded by the destination handle (TIMER_SHARD wheels, each has its own lock), so
+	services adding timeouts at the same time rarely contend. All the shards advance together.
+
+	Timer nodes come from a pool in each shard, and they are in doubly linked lists, so a timeout
+	can be cancelled in O(1) : the shard keeps a hash of (handle, session) -> node.
+ */
 
 #define TIME_NEAR_SHIFT 8
 #define TIME_NEAR (1 << TIME_NEAR_SHIFT)
@@ -28,6 +39,11 @@ typedef void (*timer_execute_func)(void *ud,void *arg);
 #define TIME_NEAR_MASK (TIME_NEAR-1)
 #define TIME_LEVEL_MASK (TIME_LEVEL-1)
 
+#define TIMER_SHARD 16
+#define TIMER_POOL_BLOCK 64
+#define TIMER_HASH_SIZE 64
+#define TIMER_BATCH 256
+
 struct timer_event {
 	uint32_t handle;
 	int session;
@@ -35,50 +51,176 @@ struct timer_event {
 
 struct timer_node {
 	struct timer_node *next;
+	struct timer_node *prev;
+	struct timer_node *hnext;
+	struct timer_node **hprev;
 	uint32_t expire;
+	struct timer_event event;
 };
 
+// circular list with a sentinel
 struct link_list {
 	struct timer_node head;
-	struct timer_node *tail;
 };
 
-struct timer {
+struct timer_shard {
 	struct link_list near[TIME_NEAR];
 	struct link_list t[4][TIME_LEVEL];
+	uint64_t near_bits[TIME_NEAR / 64];	// the near slots may not be empty
 	struct spinlock lock;
 	uint32_t time;
+	struct timer_node *freelist;
+	int hash_size;
+	int count;
+	struct timer_node **hash;
+};
+
+/*
+	The wheel ticks every `tick` ms. The default tick is 10ms (1/100 sec), set timer_tick (1, 2 or 5)
+	in config for high resolution mode, the timer thread is driven by a timerfd then.
+	skynet_now() and skynet_timeout() are always in 1/100 sec.
+ */
+
+struct timer {
+	struct timer_shard shard[TIMER_SHARD];
+	int tick;	// ms per tick
+	int fd;	// timerfd for high resolution mode
 	uint32_t starttime;
-	uint64_t current;
-	uint64_t current_point;
+	uint32_t remain;	// ms not counted in current
+	uint64_t current;	// in 1/100 sec
+	uint64_t current_point;	// in tick
 };
 
 static struct timer * TI = NULL;
 static uint32_t debug_diff_time = 0;
 
+static inline void
+link_init(struct link_list *list) {
+	list->head.next = list->head.prev = &list->head;
+}
+
+static inline int
+link_empty(struct link_list *list) {
+	return list->head.next == &list->head;
+}
+
+// detach all the nodes, return a NULL terminated list
 static inline struct timer_node *
 link_clear(struct link_list *list) {
+	if (link_empty(list))
+		return NULL;
 	struct timer_node * ret = list->head.next;
-	list->head.next = 0;
-	list->tail = &(list->head);
+	list->head.prev->next = NULL;
+	link_init(list);
 
 	return ret;
 }
 
 static inline void
-link(struct link_list *list,struct timer_node *node) {
-	list->tail->next = node;
-	list->tail = node;
-	node->next=0;
+link_node(struct link_list *list,struct timer_node *node) {
+	struct timer_node *tail = list->head.prev;
+	node->prev = tail;
+	node->next = &list->head;
+	tail->next = node;
+	list->head.prev = node;
+}
+
+static inline void
+unlink_node(struct timer_node *node) {
+	node->prev->next = node->next;
+	node->next->prev = node->prev;
+}
+
+static inline struct timer_shard *
+get_shard(struct timer *T, uint32_t handle) {
+	return &T->shard[handle % TIMER_SHARD];
+}
+
+static inline uint32_t
+hash_event(uint32_t handle, int session) {
+	return handle * 0x9e3779b1u ^ (uint32_t)session;
+}
+
+static void
+hash_insert(struct timer_shard *T, struct timer_node *node) {
+	struct timer_node **bucket = &T->hash[hash_event(node->event.handle, node->event.session) & (T->hash_size-1)];
+	node->hnext = *bucket;
+	if (node->hnext)
+		node->hnext->hprev = &node->hnext;
+	node->hprev = bucket;
+	*bucket = node;
+}
+
+static inline void
+hash_remove(struct timer_node *node) {
+	*node->hprev = node->hnext;
+	if (node->hnext)
+		node->hnext->hprev = node->hprev;
+}
+
+static void
+hash_expand(struct timer_shard *T) {
+	struct timer_node **old = T->hash;
+	int old_size = T->hash_size;
+	T->hash_size *= 2;
+	T->hash = skynet_malloc(T->hash_size * sizeof(struct timer_node *));
+	memset(T->hash, 0, T->hash_size * sizeof(struct timer_node *));
+	int i;
+	for (i=0;i<old_size;i++) {
+		struct timer_node *node = old[i];
+		while (node) {
+			struct timer_node *next = node->hnext;
+			hash_insert(T, node);
+			node = next;
+		}
+	}
+	skynet_free(old);
+}
+
+static struct timer_node *
+hash_find(struct timer_shard *T, uint32_t handle, int session) {
+	struct timer_node *node = T->hash[hash_event(handle, session) & (T->hash_size-1)];
+	while (node) {
+		if (node->event.handle == handle && node->event.session == session)
+			return node;
+		node = node->hnext;
+	}
+	return NULL;
+}
+
+static struct timer_node *
+node_alloc(struct timer_shard *T) {
+	if (T->freelist == NULL) {
+		// nodes are never returned to the system, they are reused by the shard.
+		struct timer_node *block = skynet_malloc(TIMER_POOL_BLOCK * sizeof(struct timer_node));
+		int i;
+		for (i=0;i<TIMER_POOL_BLOCK;i++) {
+			block[i].next = T->freelist;
+			T->freelist = &block[i];
+		}
+	}
+	struct timer_node *node = T->freelist;
+	T->freelist = node->next;
+	return node;
+}
+
+static inline void
+node_free(struct timer_shard *T, struct timer_node *node) {
+	hash_remove(node);
+	--T->count;
+	node->next = T->freelist;
+	T->freelist = node;
 }
 
 static void
-add_node(struct timer *T,struct timer_node *node) {
+add_node(struct timer_shard *T,struct timer_node *node) {
 	uint32_t time=node->expire;
 	uint32_t current_time=T->time;
 	
 	if ((time|TIME_NEAR_MASK)==(current_time|TIME_NEAR_MASK)) {
-		link(&T->near[time&TIME_NEAR_MASK],node);
+		int idx = time&TIME_NEAR_MASK;
+		link_node(&T->near[idx],node);
+		T->near_bits[idx / 64] |= (uint64_t)1 << (idx % 64);
 	} else {
 		int i;
 		uint32_t mask=TIME_NEAR << TIME_LEVEL_SHIFT;
@@ -89,25 +231,49 @@ add_node(struct timer *T,struct timer_node *node) {
 			mask <<= TIME_LEVEL_SHIFT;
 		}
 
-		link(&T->t[i][((time>>(TIME_NEAR_SHIFT + i*TIME_LEVEL_SHIFT)) & TIME_LEVEL_MASK)],node);	
+		link_node(&T->t[i][((time>>(TIME_NEAR_SHIFT + i*TIME_LEVEL_SHIFT)) & TIME_LEVEL_MASK)],node);	
 	}
 }
 
 static void
-timer_add(struct timer *T,void *arg,size_t sz,int time) {
-	struct timer_node *node = (struct timer_node *)skynet_malloc(sizeof(*node)+sz);
-	memcpy(node+1,arg,sz);
+timer_add(struct timer *timer, struct timer_event *event, int time) {
+	struct timer_shard *T = get_shard(timer, event->handle);
 
 	SPIN_LOCK(T);
 
+		struct timer_node *node = node_alloc(T);
+		node->event = *event;
 		node->expire=time+T->time;
+		if (++T->count > T->hash_size * 2) {
+			hash_expand(T);
+		}
+		hash_insert(T, node);
 		add_node(T,node);
 
 	SPIN_UNLOCK(T);
 }
 
+static int
+timer_cancel(struct timer *timer, uint32_t handle, int session) {
+	struct timer_shard *T = get_shard(timer, handle);
+	int ret = 0;
+
+	SPIN_LOCK(T);
+
+		struct timer_node *node = hash_find(T, handle, session);
+		if (node) {
+			unlink_node(node);
+			node_free(T, node);
+			ret = 1;
+		}
+
+	SPIN_UNLOCK(T);
+
+	return ret;
+}
+
 static void
-move_list(struct timer *T, int level, int idx) {
+move_list(struct timer_shard *T, int level, int idx) {
 	struct timer_node *current = link_clear(&T->t[level][idx]);
 	while (current) {
 		struct timer_node *temp=current->next;
@@ -117,7 +283,7 @@ move_list(struct timer *T, int level, int idx) {
 }
 
 static void
-timer_shift(struct timer *T) {
+timer_shift(struct timer_shard *T) {
 	int mask = TIME_NEAR;
 	uint32_t ct = ++T->time;
 	if (ct == 0) {
@@ -139,50 +305,132 @@ timer_shift(struct timer *T) {
 	}
 }
 
-static inline void
-dispatch_list(struct timer_node *current) {
-	do {
-		struct timer_event * event = (struct timer_event *)(current+1);
-		struct skynet_message message;
-		message.source = 0;
-		message.session = event->session;
-		message.data = NULL;
-		message.sz = (size_t)PTYPE_RESPONSE << MESSAGE_TYPE_SHIFT;
+struct event_order {
+	struct timer_event event;
+	int index;
+};
 
-		skynet_context_push(event->handle, &message);
-		
-		struct timer_node * temp = current;
-		current=current->next;
-		skynet_free(temp);	
-	} while (current);
+static int
+compare_event(const void *a, const void *b) {
+	const struct event_order *ea = a;
+	const struct event_order *eb = b;
+	if (ea->event.handle != eb->event.handle)
+		return ea->event.handle < eb->event.handle ? -1 : 1;
+	return ea->index - eb->index;
+}
+
+// push the events of the same destination together (keep the order of each destination)
+static void
+dispatch_events(struct event_order *ev, int n) {
+	qsort(ev, n, sizeof(ev[0]), compare_event);
+	struct skynet_message message[TIMER_BATCH];
+	int i = 0;
+	while (i < n) {
+		uint32_t handle = ev[i].event.handle;
+		int c = 0;
+		do {
+			struct skynet_message *m = &message[c++];
+			m->source = 0;
+			m->session = ev[i].event.session;
+			m->data = NULL;
+			m->sz = (size_t)PTYPE_RESPONSE << MESSAGE_TYPE_SHIFT;
+			++i;
+		} while (i < n && ev[i].event.handle == handle);
+		skynet_context_push_batch(handle, message, c);
+	}
+}
+
+// expired events are collected in the buffer, and dispatched when it's full or at the end of update
+struct event_buffer {
+	int n;
+	struct event_order ev[TIMER_BATCH];
+};
+
+static void
+flush_events(struct timer_shard *T, struct event_buffer *buf) {
+	SPIN_UNLOCK(T);
+	// dispatch_events don't need lock T
+	dispatch_events(buf->ev, buf->n);
+	buf->n = 0;
+	SPIN_LOCK(T);
 }
 
 static inline void
-timer_execute(struct timer *T) {
+timer_execute(struct timer_shard *T, struct event_buffer *buf) {
 	int idx = T->time & TIME_NEAR_MASK;
+	struct link_list *list = &T->near[idx];
 	
-	while (T->near[idx].head.next) {
-		struct timer_node *current = link_clear(&T->near[idx]);
-		SPIN_UNLOCK(T);
-		// dispatch_list don't need lock T
-		dispatch_list(current);
-		SPIN_LOCK(T);
+	while (!link_empty(list)) {
+		struct timer_node *node = list->head.next;
+		unlink_node(node);
+		buf->ev[buf->n].event = node->event;
+		buf->ev[buf->n].index = buf->n;
+		node_free(T, node);
+		if (++buf->n >= TIMER_BATCH) {
+			flush_events(T, buf);
+		}
+	}
+	T->near_bits[idx / 64] &= ~((uint64_t)1 << (idx % 64));
+}
+
+// how many near slots after idx (at most n) are empty, so the ticks can be skipped.
+static uint32_t
+empty_slots(struct timer_shard *T, uint32_t idx, uint32_t n) {
+	uint32_t i;
+	for (i=0;i<n;) {
+		uint32_t slot = idx + 1 + i;
+		uint64_t bits = T->near_bits[slot / 64] >> (slot % 64);
+		if (bits) {
+			i += __builtin_ctzll(bits);
+			return i < n ? i : n;
+		}
+		i += 64 - slot % 64;
+	}
+	return n;
+}
+
+// advance diff ticks in one locked pass
+static void
+timer_advance(struct timer_shard *T, uint32_t diff, struct event_buffer *buf) {
+	while (diff > 0) {
+		if (T->count == 0) {
+			// nothing in the wheel
+			T->time += diff;
+			return;
+		}
+		uint32_t idx = T->time & TIME_NEAR_MASK;
+		// Skip the ticks with empty near slot, but stop before the next cascade (idx wraps to 0).
+		uint32_t skip = empty_slots(T, idx, TIME_NEAR_MASK - idx < diff - 1 ? TIME_NEAR_MASK - idx : diff - 1);
+		T->time += skip;
+		diff -= skip;
+
+		// shift time first, and then dispatch timer message
+		timer_shift(T);
+		timer_execute(T, buf);
+		--diff;
 	}
 }
 
 static void 
-timer_update(struct timer *T) {
-	SPIN_LOCK(T);
+timer_update(struct timer *timer, uint32_t diff) {
+	int i;
+	struct event_buffer buf;
+	for (i=0;i<TIMER_SHARD;i++) {
+		struct timer_shard *T = &timer->shard[i];
+		buf.n = 0;
+		SPIN_LOCK(T);
 
-	// try to dispatch timeout 0 (rare condition)
-	timer_execute(T);
+		// try to dispatch timeout 0 (rare condition)
+		timer_execute(T, &buf);
 
-	// shift time first, and then dispatch timer message
-	timer_shift(T);
+		timer_advance(T, diff, &buf);
 
-	timer_execute(T);
+		if (buf.n > 0) {
+			flush_events(T, &buf);
+		}
 
-	SPIN_UNLOCK(T);
+		SPIN_UNLOCK(T);
+	}
 }
 
 static struct timer *
@@ -190,27 +438,34 @@ timer_create_timer() {
 	struct timer *r=(struct timer *)skynet_malloc(sizeof(struct timer));
 	memset(r,0,sizeof(*r));
 
-	int i,j;
+	int s,i,j;
 
-	for (i=0;i<TIME_NEAR;i++) {
-		link_clear(&r->near[i]);
-	}
+	for (s=0;s<TIMER_SHARD;s++) {
+		struct timer_shard *T = &r->shard[s];
+		for (i=0;i<TIME_NEAR;i++) {
+			link_init(&T->near[i]);
+		}
 
-	for (i=0;i<4;i++) {
-		for (j=0;j<TIME_LEVEL;j++) {
-			link_clear(&r->t[i][j]);
+		for (i=0;i<4;i++) {
+			for (j=0;j<TIME_LEVEL;j++) {
+				link_init(&T->t[i][j]);
+			}
 		}
-	}
 
-	SPIN_INIT(r)
+		T->hash_size = TIMER_HASH_SIZE;
+		T->hash = skynet_malloc(T->hash_size * sizeof(struct timer_node *));
+		memset(T->hash, 0, T->hash_size * sizeof(struct timer_node *));
+
+		SPIN_INIT(T)
+	}
 
 	r->current = 0;
 
 	return r;
 }
 
-int
-skynet_timeout(uint32_t handle, int time, int session) {
+static int
+timeout_tick(uint32_t handle, int time, int session) {
 	if (time <= 0) {
 		struct skynet_message message;
 		message.source = 0;
@@ -225,12 +480,33 @@ skynet_timeout(uint32_t handle, int time, int session) {
 		struct timer_event event;
 		event.handle = handle;
 		event.session = session;
-		timer_add(TI, &event, sizeof(event), time);
+		timer_add(TI, &event, time);
 	}
 
 	return session;
 }
 
+int
+skynet_timeout(uint32_t handle, int time, int session) {
+	if (time > 0) {
+		time = (int)((int64_t)time * 10 / TI->tick);
+	}
+	return timeout_tick(handle, time, session);
+}
+
+int
+skynet_timeout_ms(uint32_t handle, int ms, int session) {
+	if (ms > 0) {
+		ms = (ms + TI->tick - 1) / TI->tick;
+	}
+	return timeout_tick(handle, ms, session);
+}
+
+int
+skynet_timeout_cancel(uint32_t handle, int session) {
+	return timer_cancel(TI, handle, session);
+}
+
 // centisecond: 1/100 second
 static void
 systime(uint32_t *sec, uint32_t *cs) {
@@ -247,21 +523,23 @@ systime(uint32_t *sec, uint32_t *cs) {
 #endif
 }
 
+// in tick
 static uint64_t
 gettime() {
 	uint64_t t;
+	int tick = TI->tick;
 #if !defined(__APPLE__) || defined(AVAILABLE_MAC_OS_X_VERSION_10_12_AND_LATER)
 	struct timespec ti;
 	clock_gettime(CLOCK_MONOTONIC, &ti);
-	t = (uint64_t)ti.tv_sec * 100;
-	t += ti.tv_nsec / 10000000;
+	t = (uint64_t)ti.tv_sec * (1000 / tick);
+	t += ti.tv_nsec / (tick * 1000000);
 #else
 	struct timeval tv;
 	gettimeofday(&tv, NULL);
-	t = (uint64_t)tv.tv_sec * 100;
-	t += tv.tv_usec / 10000;
+	t = (uint64_t)tv.tv_sec * (1000 / tick);
+	t += tv.tv_usec / (tick * 1000);
 #endif
-	return t + debug_diff_time;
+	return t + (uint64_t)debug_diff_time * 10 / tick;
 }
 
 void
@@ -273,11 +551,15 @@ skynet_updatetime(void) {
 	} else if (cp != TI->current_point) {
 		uint32_t diff = (uint32_t)(cp - TI->current_point);
 		TI->current_point = cp;
-		TI->current += diff;
-		int i;
-		for (i=0;i<diff;i++) {
-			timer_update(TI);
+		if (TI->tick == 10) {
+			TI->current += diff;
+		} else {
+			uint64_t ms = (uint64_t)diff * TI->tick + TI->remain;
+			TI->current += ms / 10;
+			TI->remain = ms % 10;
 		}
+		// catch up all the ticks at once, after a long stall (or skynet_addtime)
+		timer_update(TI, diff);
 	}
 }
 
@@ -307,9 +589,56 @@ skynet_resettime(void) {
 	}
 }
 
+void
+skynet_timer_sleep(void) {
+#if defined(__linux__)
+	if (TI->fd >= 0) {
+		uint64_t expirations;
+		if (read(TI->fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+			return;
+	}
+#endif
+	if (TI->tick == 10) {
+		usleep(2500);
+	} else {
+		usleep(TI->tick * 1000 / 2);
+	}
+}
+
+static int
+create_timerfd(int tick) {
+#if defined(__linux__)
+	int fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	struct itimerspec its;
+	its.it_interval.tv_sec = 0;
+	its.it_interval.tv_nsec = tick * 1000000;
+	its.it_value = its.it_interval;
+	if (timerfd_settime(fd, 0, &its, NULL)) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+#else
+	return -1;
+#endif
+}
+
 void 
-skynet_timer_init(void) {
+skynet_timer_init(int tick) {
 	TI = timer_create_timer();
+	if (tick != 1 && tick != 2 && tick != 5) {
+		tick = 10;
+	}
+	TI->tick = tick;
+	TI->fd = -1;
+	if (tick != 10) {
+		TI->fd = create_timerfd(tick);
+		if (TI->fd < 0) {
+			skynet_error(NULL, "timerfd create failed, use usleep for timer_tick %d", tick);
+		}
+	}
 	uint32_t current = 0;
 	systime(&TI->starttime, &current);
 	TI->current = current;
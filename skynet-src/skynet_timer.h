@@ -4,10 +4,16 @@
 #include <stdint.h>
 
 int skynet_timeout(uint32_t handle, int time, int session);
+int skynet_timeout_ms(uint32_t handle, int ms, int session);
+// return 1 if the timeout is cancelled, 0 if it's not found (or has expired)
+int skynet_timeout_cancel(uint32_t handle, int session);
 void skynet_updatetime(void);
 uint32_t skynet_starttime(void);
 uint64_t skynet_thread_time(void);	// for profile, in micro second
 
-void skynet_timer_init(void);
+// tick : ms per tick, 10 (default), or 1/2/5 for high resolution mode
+void skynet_timer_init(int tick);
+// wait for the next update in timer thread
+void skynet_timer_sleep(void);
 
 #endif
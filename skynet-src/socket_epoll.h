@@ -10,6 +10,14 @@
 #include <arpa/inet.h>
 #include <fcntl.h>
 
+#ifdef USE_EPOLLET
+// edge triggered : the socket server reads, writes and accepts until EAGAIN
+#define SP_EDGE_TRIGGER
+#define SP_ET EPOLLET
+#else
+#define SP_ET 0
+#endif
+
 static bool 
 sp_invalid(int efd) {
 	return efd == -1;
@@ -28,7 +36,7 @@ sp_release(int efd) {
 static int 
 sp_add(int efd, int sock, void *ud) {
 	struct epoll_event ev;
-	ev.events = EPOLLIN;
+	ev.events = EPOLLIN | SP_ET;
 	ev.data.ptr = ud;
 	if (epoll_ctl(efd, EPOLL_CTL_ADD, sock, &ev) == -1) {
 		return 1;
@@ -42,9 +50,10 @@ sp_del(int efd, int sock) {
 }
 
 static void 
-sp_write(int efd, int sock, void *ud, bool enable) {
+sp_enable(int efd, int sock, void *ud, bool read_enable, bool write_enable) {
 	struct epoll_event ev;
-	ev.events = EPOLLIN | (enable ? EPOLLOUT : 0);
+	// EPOLL_CTL_MOD checks the state again, so the edge isn't lost when read (or write) is enabled.
+	ev.events = (read_enable ? EPOLLIN : 0) | (write_enable ? EPOLLOUT : 0) | SP_ET;
 	ev.data.ptr = ud;
 	epoll_ctl(efd, EPOLL_CTL_MOD, sock, &ev);
 }
@@ -3,7 +3,11 @@
 
 #include <stdbool.h>
 
+#if defined(__linux__) && defined(USE_IO_URING)
+typedef struct sp_uring * poll_fd;
+#else
 typedef int poll_fd;
+#endif
 
 struct event {
 	void * s;
@@ -11,6 +15,13 @@ struct event {
 	bool write;
 	bool error;
 	bool eof;
+#if defined(__linux__) && defined(USE_IO_URING)
+	// the completion of recv (socket_uring.h), size is the bytes (0 : eof, < 0 : -errno) in data.
+	// data is valid until the next sp_wait.
+	bool recv;
+	int size;
+	char * data;
+#endif
 };
 
 static bool sp_invalid(poll_fd fd);
@@ -18,13 +29,17 @@ static poll_fd sp_create();
 static void sp_release(poll_fd fd);
 static int sp_add(poll_fd fd, int sock, void *ud);
 static void sp_del(poll_fd fd, int sock);
-static void sp_write(poll_fd, int sock, void *ud, bool enable);
+static void sp_enable(poll_fd, int sock, void *ud, bool read_enable, bool write_enable);
 static int sp_wait(poll_fd, struct event *e, int max);
 static void sp_nonblocking(int sock);
 
 #ifdef __linux__
+#ifdef USE_IO_URING
+#include "socket_uring.h"
+#else
 #include "socket_epoll.h"
 #endif
+#endif
 
 #if defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined (__NetBSD__)
 #include "socket_kqueue.h"
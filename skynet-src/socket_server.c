@@ -1,3 +1,10 @@
+#ifdef __linux__
+#ifndef _GNU_SOURCE
+// for recvmmsg / sendmmsg
+#define _GNU_SOURCE
+#endif
+#endif
+
 #include "skynet.h"
 
 #include "socket_server.h"
@@ -7,6 +14,12 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <linux/errqueue.h>
+#endif
 #include <netinet/tcp.h>
 #include <unistd.h>
 #include <errno.h>
@@ -14,6 +27,9 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <limits.h>
+#include <sched.h>
+#include <fcntl.h>
 #include <assert.h>
 #include <string.h>
 
@@ -22,6 +38,9 @@
 #define MAX_SOCKET_P 16
 #define MAX_EVENT 64
 #define MIN_READ_BUFFER 64
+#define MAX_READ_BUFFER (64 * 1024)
+// edge triggered : read at most MAX_DRAIN_BUFFER bytes for one message, then the event is handled again.
+#define MAX_DRAIN_BUFFER (1024 * 1024)
 #define SOCKET_TYPE_INVALID 0
 #define SOCKET_TYPE_RESERVE 1
 #define SOCKET_TYPE_PLISTEN 2
@@ -49,6 +68,9 @@
 
 #define MAX_UDP_PACKAGE 65535
 
+// max datagrams in one recvmmsg / sendmmsg
+#define UDP_BATCH 16
+
 // EAGAIN and EWOULDBLOCK may be not the same value.
 #if (EAGAIN != EWOULDBLOCK)
 #define AGAIN_WOULDBLOCK EAGAIN : case EWOULDBLOCK
@@ -58,12 +80,30 @@
 
 #define WARNING_SIZE (1024*1024)
 
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY)
+#define ZEROCOPY_SUPPORT
+#endif
+
+// the buffers not less than ZEROCOPY_SIZE are sent by MSG_ZEROCOPY, see socket_server_zerocopy
+#define ZEROCOPY_SIZE (32*1024)
+
+// max buffers in one writev
+#if defined(IOV_MAX) && IOV_MAX < 1024
+#define MAX_IOV IOV_MAX
+#else
+#define MAX_IOV 1024
+#endif
+
 struct write_buffer {
 	struct write_buffer * next;
 	void *buffer;
 	char *ptr;
 	int sz;
 	bool userobject;
+	bool zcsent;	// sent by MSG_ZEROCOPY, zcseq is the last send
+	uint32_t zcseq;
+	int fd;	// the file sent by sendfile (buffer is NULL), or -1
+	off_t offset;	// of the file
 	uint8_t udp_address[UDP_ADDRESS_SIZE];
 };
 
@@ -85,6 +125,7 @@ struct socket_stat {
 struct socket {
 	uintptr_t opaque;
 	struct wb_list high;
+	struct wb_list zc;	// the buffers sent by MSG_ZEROCOPY, wait for the completion
 	struct wb_list low;
 	int64_t wb_size;
 	struct socket_stat stat;
@@ -94,6 +135,13 @@ struct socket {
 	uint8_t protocol;
 	uint8_t type;
 	uint16_t udpconnecting;
+	bool udpbatch;
+	bool zerocopy;
+	bool reading;
+	bool writing;
+	uint8_t paused;	// SOCKET_PAUSE_* bits, the socket isn't read when any bit is set
+	uint32_t zcseq;	// the next MSG_ZEROCOPY send
+	uint32_t zcack;	// the sends before it are completed
 	int64_t warn_size;
 	union {
 		int size;
@@ -107,19 +155,23 @@ struct socket {
 
 struct socket_server {
 	volatile uint64_t time;
+	struct ctrl_ring * ctrl;
 	int recvctrl_fd;
 	int sendctrl_fd;
 	int checkctrl;
 	poll_fd event_fd;
 	int alloc_id;
+	int shard_index;
+	int shard_count;
+	int accept_index;
+	struct socket_server ** group;
 	int event_n;
 	int event_index;
 	struct socket_object_interface soi;
 	struct event ev[MAX_EVENT];
 	struct socket slot[MAX_SOCKET];
 	char buffer[MAX_INFO];
-	uint8_t udpbuffer[MAX_UDP_PACKAGE];
-	fd_set rfds;
+	struct udp_ring * udp;
 };
 
 struct request_open {
@@ -169,6 +221,28 @@ struct request_start {
 	uintptr_t opaque;
 };
 
+struct request_udpbatch {
+	int id;
+	int enable;
+};
+
+struct request_zerocopy {
+	int id;
+};
+
+struct request_sendfile {
+	int id;
+	int fd;
+	int sz;
+	int64_t offset;
+};
+
+struct request_pause {
+	int id;
+	int reason;
+	int pause;
+};
+
 struct request_setopt {
 	int id;
 	int what;
@@ -197,11 +271,14 @@ struct request_udp {
 	T Set opt
 	U Create UDP socket
 	C set udp address
+	M set udp batch mode
+	Z enable zerocopy
+	F Send file
+	R Pause / resume reading
 	Q query info
  */
 
 struct request_package {
-	uint8_t header[8];	// 6 bytes dummy
 	union {
 		char buffer[256];
 		struct request_open open;
@@ -214,16 +291,93 @@ struct request_package {
 		struct request_setopt setopt;
 		struct request_udp udp;
 		struct request_setudp set_udp;
+		struct request_udpbatch udpbatch;
+		struct request_zerocopy zerocopy;
+		struct request_sendfile sendfile;
+		struct request_pause pause;
 	} u;
 	uint8_t dummy[256];
 };
 
+/*
+	The requests are queued in a bounded MPSC ring, each slot has a sequence number :
+	a producer claims a slot by CAS on tail, copies the request in, and publishes it by setting seq = pos + 1.
+	The socket thread is the only consumer, it releases the slot by setting seq = pos + CTRL_RING_SIZE.
+
+	The eventfd (a pipe on other platforms) only wakes the socket thread up.
+	A producer writes it when notify changes from 0 to 1, and the socket thread drains the ring,
+	and resets notify only when the ring is empty, so many requests are handled for one wakeup.
+ */
+
+#define CTRL_RING_SIZE 2048
+#define CACHELINE_SIZE 64
+
+struct ctrl_slot {
+	volatile uint32_t seq;
+	uint8_t type;
+	uint8_t len;
+	uint8_t buffer[256];
+};
+
+struct ctrl_ring {
+	volatile uint32_t tail;
+	volatile int notify;
+	char pad[CACHELINE_SIZE - sizeof(uint32_t) - sizeof(int)];
+	uint32_t head;	// only the socket thread reads the ring
+	struct ctrl_slot slot[CTRL_RING_SIZE];
+};
+
 union sockaddr_all {
 	struct sockaddr s;
 	struct sockaddr_in v4;
 	struct sockaddr_in6 v6;
 };
 
+#if !defined(HAVE_MMSG) && (defined(__linux__) || defined(__FreeBSD__) || defined(__NetBSD__))
+// recvmmsg / sendmmsg are in linux 3.0, freebsd 11 and netbsd 7. Define HAVE_MMSG for other systems which have them.
+#define HAVE_MMSG
+#endif
+
+#ifndef HAVE_MMSG
+// no recvmmsg / sendmmsg (macosx ...). These fallbacks read or write ONE datagram per call only,
+// they ignore n and return 1, the callers loop on the result.
+
+struct mmsghdr {
+	struct msghdr msg_hdr;
+	unsigned int msg_len;
+};
+
+static int
+recvmmsg(int fd, struct mmsghdr *msg, unsigned int n, int flags, void *timeout) {
+	ssize_t sz = recvmsg(fd, &msg[0].msg_hdr, flags);
+	if (sz < 0)
+		return -1;
+	msg[0].msg_len = (unsigned int)sz;
+	return 1;
+}
+
+static int
+sendmmsg(int fd, struct mmsghdr *msg, unsigned int n, int flags) {
+	ssize_t sz = sendmsg(fd, &msg[0].msg_hdr, flags);
+	if (sz < 0)
+		return -1;
+	msg[0].msg_len = (unsigned int)sz;
+	return 1;
+}
+
+#endif
+
+// the datagrams read by one recvmmsg, in a pooled buffer
+struct udp_ring {
+	int id;	// the socket these datagrams come from
+	int n;
+	int index;
+	struct mmsghdr msg[UDP_BATCH];
+	struct iovec iov[UDP_BATCH];
+	union sockaddr_all addr[UDP_BATCH];
+	uint8_t * buffer;	// UDP_BATCH * MAX_UDP_PACKAGE
+};
+
 struct send_object {
 	void * buffer;
 	int sz;
@@ -288,7 +442,9 @@ send_object_init(struct socket_server *ss, struct send_object *so, void *object,
 
 static inline void
 write_buffer_free(struct socket_server *ss, struct write_buffer *wb) {
-	if (wb->userobject) {
+	if (wb->fd >= 0) {
+		close(wb->fd);
+	} else if (wb->userobject) {
 		ss->soi.free(wb->buffer);
 	} else {
 		FREE(wb->buffer);
@@ -308,14 +464,33 @@ socket_keepalive(int fd) {
 	setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, (void*)&keepalive_interval, sizeof(keepalive_interval));
 }
 
+/*
+	The sockets can be sharded across a group of socket servers (see socket_server_group).
+	An id is [tag * shard_count + shard_index][slot (MAX_SOCKET_P bits)], so the shard of an id is known
+	without any lookup, and each shard can still use all of its MAX_SOCKET slots.
+	The id is n itself when there is only one shard.
+ */
+static inline int
+shard_id(struct socket_server *ss, int n) {
+	unsigned tag_limit = (((unsigned)0x7fffffff >> MAX_SOCKET_P) + 1) / ss->shard_count;
+	unsigned tag = ((unsigned)n >> MAX_SOCKET_P) % tag_limit;
+	return (int)((tag * ss->shard_count + ss->shard_index) << MAX_SOCKET_P | HASH_ID(n));
+}
+
+int
+socket_server_shard(int id, int count) {
+	return (int)(((unsigned)id >> MAX_SOCKET_P) % count);
+}
+
 static int
 reserve_id(struct socket_server *ss) {
 	int i;
 	for (i=0;i<MAX_SOCKET;i++) {
-		int id = ATOM_INC(&(ss->alloc_id));
-		if (id < 0) {
-			id = ATOM_AND(&(ss->alloc_id), 0x7fffffff);
+		int n = ATOM_INC(&(ss->alloc_id));
+		if (n < 0) {
+			n = ATOM_AND(&(ss->alloc_id), 0x7fffffff);
 		}
+		int id = shard_id(ss, n);
 		struct socket *s = &ss->slot[HASH_ID(id)];
 		if (s->type == SOCKET_TYPE_INVALID) {
 			if (ATOM_CAS(&s->type, SOCKET_TYPE_INVALID, SOCKET_TYPE_RESERVE)) {
@@ -341,6 +516,38 @@ clear_wb_list(struct wb_list *list) {
 	list->tail = NULL;
 }
 
+static int
+ctrl_signal_create(int fd[2]) {
+#ifdef __linux__
+	fd[0] = fd[1] = eventfd(0, EFD_NONBLOCK);
+	return fd[0] < 0;
+#else
+	if (pipe(fd))
+		return 1;
+	fcntl(fd[0], F_SETFL, fcntl(fd[0], F_GETFL, 0) | O_NONBLOCK);
+	return 0;
+#endif
+}
+
+static void
+ctrl_signal_close(int fd[2]) {
+	close(fd[0]);
+	if (fd[1] != fd[0]) {
+		close(fd[1]);
+	}
+}
+
+static struct ctrl_ring *
+ctrl_ring_create() {
+	struct ctrl_ring * r = MALLOC(sizeof(*r));
+	memset(r, 0, sizeof(*r));
+	uint32_t i;
+	for (i=0;i<CTRL_RING_SIZE;i++) {
+		r->slot[i].seq = i;
+	}
+	return r;
+}
+
 struct socket_server * 
 socket_server_create(uint64_t time) {
 	int i;
@@ -350,16 +557,15 @@ socket_server_create(uint64_t time) {
 		fprintf(stderr, "socket-server: create event pool failed.\n");
 		return NULL;
 	}
-	if (pipe(fd)) {
+	if (ctrl_signal_create(fd)) {
 		sp_release(efd);
-		fprintf(stderr, "socket-server: create socket pair failed.\n");
+		fprintf(stderr, "socket-server: create ctrl signal failed.\n");
 		return NULL;
 	}
 	if (sp_add(efd, fd[0], NULL)) {
 		// add recvctrl_fd to event poll
 		fprintf(stderr, "socket-server: can't add server fd to event pool.\n");
-		close(fd[0]);
-		close(fd[1]);
+		ctrl_signal_close(fd);
 		sp_release(efd);
 		return NULL;
 	}
@@ -367,6 +573,7 @@ socket_server_create(uint64_t time) {
 	struct socket_server *ss = MALLOC(sizeof(*ss));
 	ss->time = time;
 	ss->event_fd = efd;
+	ss->ctrl = ctrl_ring_create();
 	ss->recvctrl_fd = fd[0];
 	ss->sendctrl_fd = fd[1];
 	ss->checkctrl = 1;
@@ -376,18 +583,33 @@ socket_server_create(uint64_t time) {
 		s->type = SOCKET_TYPE_INVALID;
 		clear_wb_list(&s->high);
 		clear_wb_list(&s->low);
+		clear_wb_list(&s->zc);
 		spinlock_init(&s->dw_lock);
 	}
 	ss->alloc_id = 0;
+	ss->shard_index = 0;
+	ss->shard_count = 1;
+	ss->accept_index = 0;
+	ss->group = NULL;
+	ss->udp = NULL;
 	ss->event_n = 0;
 	ss->event_index = 0;
 	memset(&ss->soi, 0, sizeof(ss->soi));
-	FD_ZERO(&ss->rfds);
-	assert(ss->recvctrl_fd < FD_SETSIZE);
 
 	return ss;
 }
 
+void
+socket_server_group(struct socket_server **group, int count) {
+	int i;
+	for (i=0;i<count;i++) {
+		struct socket_server *ss = group[i];
+		ss->shard_index = i;
+		ss->shard_count = count;
+		ss->group = group;
+	}
+}
+
 void
 socket_server_updatetime(struct socket_server *ss, uint64_t time) {
 	ss->time = time;
@@ -424,6 +646,13 @@ force_close(struct socket_server *ss, struct socket *s, struct socket_lock *l, s
 	assert(s->type != SOCKET_TYPE_RESERVE);
 	free_wb_list(ss,&s->high);
 	free_wb_list(ss,&s->low);
+	if (s->zc.head) {
+		// The completions of MSG_ZEROCOPY can't be read after close, and the kernel would retransmit
+		// from the pages of these buffers. Reset the connection (linger 0), the send queue is purged at close,
+		// and then they are freed.
+		struct linger lg = { 1, 0 };
+		setsockopt(s->fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+	}
 	if (s->type != SOCKET_TYPE_PACCEPT && s->type != SOCKET_TYPE_PLISTEN) {
 		sp_del(ss->event_fd, s->fd);
 	}
@@ -433,6 +662,7 @@ force_close(struct socket_server *ss, struct socket *s, struct socket_lock *l, s
 			perror("close socket:");
 		}
 	}
+	free_wb_list(ss,&s->zc);
 	s->type = SOCKET_TYPE_INVALID;
 	if (s->dw_buffer) {
 		free_buffer(ss, s->dw_buffer, s->dw_size);
@@ -454,9 +684,14 @@ socket_server_release(struct socket_server *ss) {
 		}
 		spinlock_destroy(&s->dw_lock);
 	}
-	close(ss->sendctrl_fd);
-	close(ss->recvctrl_fd);
+	int fd[2] = { ss->recvctrl_fd, ss->sendctrl_fd };
+	ctrl_signal_close(fd);
+	FREE(ss->ctrl);
 	sp_release(ss->event_fd);
+	if (ss->udp) {
+		FREE(ss->udp->buffer);
+		FREE(ss->udp);
+	}
 	FREE(ss);
 }
 
@@ -466,6 +701,29 @@ check_wb_list(struct wb_list *s) {
 	assert(s->tail == NULL);
 }
 
+static inline void
+enable_write(struct socket_server *ss, struct socket *s, bool enable) {
+	s->writing = enable;
+	sp_enable(ss->event_fd, s->fd, s, s->reading, enable);
+}
+
+static inline void
+enable_read(struct socket_server *ss, struct socket *s, bool enable) {
+	if (s->reading != enable) {
+		s->reading = enable;
+		sp_enable(ss->event_fd, s->fd, s, enable, s->writing);
+	}
+}
+
+// the socket is connected (tcp)
+static inline void
+start_recv(struct socket_server *ss, struct socket *s) {
+#ifdef SP_RECV
+	// the poll backend reads it, see forward_message_recv
+	sp_recv(ss->event_fd, s->fd);
+#endif
+}
+
 static struct socket *
 new_fd(struct socket_server *ss, int id, int fd, int protocol, uintptr_t opaque, bool add) {
 	struct socket * s = &ss->slot[HASH_ID(id)];
@@ -482,12 +740,20 @@ new_fd(struct socket_server *ss, int id, int fd, int protocol, uintptr_t opaque,
 	s->fd = fd;
 	s->sending = ID_TAG16(id) << 16 | 0;
 	s->protocol = protocol;
+	s->udpbatch = false;
+	s->zerocopy = false;
+	s->reading = add;
+	s->writing = false;
+	s->paused = 0;
+	s->zcseq = 0;
+	s->zcack = 0;
 	s->p.size = MIN_READ_BUFFER;
 	s->opaque = opaque;
 	s->wb_size = 0;
 	s->warn_size = 0;
 	check_wb_list(&s->high);
 	check_wb_list(&s->low);
+	check_wb_list(&s->zc);
 	s->dw_buffer = NULL;
 	s->dw_size = 0;
 	memset(&s->stat, 0, sizeof(s->stat));
@@ -562,6 +828,7 @@ open_socket(struct socket_server *ss, struct request_open * request, struct sock
 
 	if(status == 0) {
 		ns->type = SOCKET_TYPE_CONNECTED;
+		start_recv(ss, ns);
 		struct sockaddr * addr = ai_ptr->ai_addr;
 		void * sin_addr = (ai_ptr->ai_family == AF_INET) ? (void*)&((struct sockaddr_in *)addr)->sin_addr : (void*)&((struct sockaddr_in6 *)addr)->sin6_addr;
 		if (inet_ntop(ai_ptr->ai_family, sin_addr, ss->buffer, sizeof(ss->buffer))) {
@@ -571,7 +838,7 @@ open_socket(struct socket_server *ss, struct request_open * request, struct sock
 		return SOCKET_OPEN;
 	} else {
 		ns->type = SOCKET_TYPE_CONNECTING;
-		sp_write(ss->event_fd, ns->fd, ns, true);
+		enable_write(ss, ns, true);
 	}
 
 	freeaddrinfo( ai_list );
@@ -582,12 +849,200 @@ _failed:
 	return SOCKET_ERR;
 }
 
+#ifdef __linux__
+
+#define file_send sendfile
+
+#else
+
+// no portable sendfile, read the file and write it.
+static ssize_t
+file_send(int sock, int fd, off_t *offset, size_t sz) {
+	char tmp[16 * 1024];
+	if (sz > sizeof(tmp))
+		sz = sizeof(tmp);
+	ssize_t n = pread(fd, tmp, sz, *offset);
+	if (n <= 0)
+		return n;
+	n = write(sock, tmp, n);
+	if (n > 0)
+		*offset += n;
+	return n;
+}
+
+#endif
+
+// return 0 when the file at the head of list is sent, -1 when the kernel buffer is full
+static int
+send_file(struct socket_server *ss, struct socket *s, struct wb_list *list, struct socket_lock *l, struct socket_message *result) {
+	struct write_buffer * wb = list->head;
+	while (wb->sz > 0) {
+		ssize_t n = file_send(s->fd, wb->fd, &wb->offset, wb->sz);
+		if (n < 0) {
+			switch(errno) {
+			case EINTR:
+				continue;
+			case AGAIN_WOULDBLOCK:
+				return -1;
+			}
+			force_close(ss,s,l,result);
+			return SOCKET_CLOSE;
+		}
+		if (n == 0) {
+			fprintf(stderr, "socket-server: file for socket (%d) is truncated, %d bytes left.\n", s->id, wb->sz);
+			n = wb->sz;
+		} else {
+			stat_write(ss,s,(int)n);
+		}
+		s->wb_size -= n;
+		wb->sz -= n;
+	}
+	list->head = wb->next;
+	write_buffer_free(ss,wb);
+	return 0;
+}
+
+#ifdef ZEROCOPY_SUPPORT
+
+// return 0 when the buffer at the head of list is sent, -1 when the kernel buffer is full
+static int
+send_zerocopy(struct socket_server *ss, struct socket *s, struct wb_list *list, struct socket_lock *l, struct socket_message *result) {
+	struct write_buffer * wb = list->head;
+	while (wb->sz > 0) {
+		int zc = 1;
+		ssize_t n = send(s->fd, wb->ptr, wb->sz, MSG_ZEROCOPY);
+		if (n < 0 && errno == ENOBUFS) {
+			// the kernel can't pin more pages (optmem_max), copy it this time.
+			zc = 0;
+			n = write(s->fd, wb->ptr, wb->sz);
+		}
+		if (n < 0) {
+			switch(errno) {
+			case EINTR:
+				continue;
+			case AGAIN_WOULDBLOCK:
+				return -1;
+			}
+			force_close(ss,s,l,result);
+			return SOCKET_CLOSE;
+		}
+		if (zc) {
+			// the kernel counts each send with MSG_ZEROCOPY, and reports the completed range.
+			wb->zcsent = true;
+			wb->zcseq = s->zcseq++;
+		}
+		stat_write(ss,s,(int)n);
+		s->wb_size -= n;
+		wb->ptr += n;
+		wb->sz -= n;
+	}
+	list->head = wb->next;
+	if (!wb->zcsent || (int32_t)(wb->zcseq - s->zcack) < 0) {
+		// not sent by MSG_ZEROCOPY, or all its sends are completed (the rest is copied by write)
+		write_buffer_free(ss,wb);
+		return 0;
+	}
+	// keep the buffer until the completion
+	wb->next = NULL;
+	if (s->zc.head == NULL) {
+		s->zc.head = s->zc.tail = wb;
+	} else {
+		s->zc.tail->next = wb;
+		s->zc.tail = wb;
+	}
+	return 0;
+}
+
+static void
+free_zerocopy(struct socket_server *ss, struct socket *s, uint32_t seq) {
+	struct write_buffer * wb;
+	// the completions of tcp are in order
+	while ((wb = s->zc.head) != NULL && (int32_t)(wb->zcseq - seq) <= 0) {
+		s->zc.head = wb->next;
+		write_buffer_free(ss,wb);
+	}
+	if (s->zc.head == NULL) {
+		s->zc.tail = NULL;
+	}
+}
+
+// read the completions from the error queue, return 1 when any completion is read.
+static int
+zerocopy_complete(struct socket_server *ss, struct socket *s) {
+	int ret = 0;
+	for (;;) {
+		char control[128];
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg(s->fd, &msg, MSG_ERRQUEUE) < 0) {
+			if (errno == EINTR)
+				continue;
+			return ret;
+		}
+		struct cmsghdr *cm;
+		for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+			struct sock_extended_err *serr = (struct sock_extended_err *)CMSG_DATA(cm);
+			if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr->ee_errno != 0)
+				continue;
+			ret = 1;
+			if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+				// the kernel copied the data (loopback, or the device can't do it), zerocopy only costs more.
+				s->zerocopy = false;
+			}
+			// [ee_info, ee_data] is the completed range
+			if ((int32_t)(serr->ee_data + 1 - s->zcack) > 0) {
+				s->zcack = serr->ee_data + 1;
+			}
+			free_zerocopy(ss, s, serr->ee_data);
+		}
+	}
+}
+
+#else
+
+static int
+send_zerocopy(struct socket_server *ss, struct socket *s, struct wb_list *list, struct socket_lock *l, struct socket_message *result) {
+	// never, s->zerocopy is always false
+	return -1;
+}
+
+#endif
+
+static inline int
+zerocopy_buffer(struct socket *s, struct write_buffer *wb) {
+	return wb->zcsent || (s->zerocopy && wb->sz >= ZEROCOPY_SIZE);
+}
+
+/*
+	Send the buffers of the list with writev, at most MAX_IOV buffers per syscall.
+	The buffers sent are freed, and the one sent partly is kept at the head of list.
+	The files (see socket_server_sendfile) are sent by sendfile,
+	and the large buffers of a zerocopy socket are sent by MSG_ZEROCOPY, they are freed at the completion.
+ */
 static int
 send_list_tcp(struct socket_server *ss, struct socket *s, struct wb_list *list, struct socket_lock *l, struct socket_message *result) {
+	struct iovec iov[MAX_IOV];
 	while (list->head) {
 		struct write_buffer * tmp = list->head;
+		if (tmp->fd >= 0 || zerocopy_buffer(s, tmp)) {
+			int r = tmp->fd >= 0 ? send_file(ss,s,list,l,result) : send_zerocopy(ss,s,list,l,result);
+			if (r != 0)
+				return r;
+			continue;
+		}
+		int n = 0;
+		size_t total = 0;
+		for (; tmp && n < MAX_IOV && tmp->fd < 0 && !zerocopy_buffer(s, tmp); tmp = tmp->next) {
+			iov[n].iov_base = tmp->ptr;
+			iov[n].iov_len = tmp->sz;
+			total += tmp->sz;
+			++n;
+		}
+		ssize_t sz;
 		for (;;) {
-			ssize_t sz = write(s->fd, tmp->ptr, tmp->sz);
+			sz = writev(s->fd, iov, n);
 			if (sz < 0) {
 				switch(errno) {
 				case EINTR:
@@ -598,17 +1053,24 @@ send_list_tcp(struct socket_server *ss, struct socket *s, struct wb_list *list,
 				force_close(ss,s,l,result);
 				return SOCKET_CLOSE;
 			}
-			stat_write(ss,s,(int)sz);
-			s->wb_size -= sz;
-			if (sz != tmp->sz) {
-				tmp->ptr += sz;
-				tmp->sz -= sz;
-				return -1;
-			}
 			break;
 		}
-		list->head = tmp->next;
-		write_buffer_free(ss,tmp);
+		stat_write(ss,s,(int)sz);
+		s->wb_size -= sz;
+		size_t left = (size_t)sz;
+		while ((tmp = list->head) != NULL && (size_t)tmp->sz <= left) {
+			left -= tmp->sz;
+			list->head = tmp->next;
+			write_buffer_free(ss,tmp);
+		}
+		if (left > 0) {
+			tmp->ptr += left;
+			tmp->sz -= left;
+		}
+		if ((size_t)sz != total) {
+			// kernel buffer is full
+			return -1;
+		}
 	}
 	list->tail = NULL;
 
@@ -648,32 +1110,61 @@ drop_udp(struct socket_server *ss, struct socket *s, struct wb_list *list, struc
 	write_buffer_free(ss,tmp);
 }
 
+// send the queued datagrams with sendmmsg, at most UDP_BATCH datagrams per syscall
 static int
 send_list_udp(struct socket_server *ss, struct socket *s, struct wb_list *list, struct socket_message *result) {
+	struct mmsghdr msg[UDP_BATCH];
+	struct iovec iov[UDP_BATCH];
+	union sockaddr_all sa[UDP_BATCH];
 	while (list->head) {
 		struct write_buffer * tmp = list->head;
-		union sockaddr_all sa;
-		socklen_t sasz = udp_socket_address(s, tmp->udp_address, &sa);
-		if (sasz == 0) {
-			fprintf(stderr, "socket-server : udp (%d) type mismatch.\n", s->id);
-			drop_udp(ss, s, list, tmp);
-			return -1;
+		int n = 0;
+		while (tmp && n < UDP_BATCH) {
+			socklen_t sasz = udp_socket_address(s, tmp->udp_address, &sa[n]);
+			if (sasz == 0) {
+				if (n > 0) {
+					// send the datagrams before it first
+					break;
+				}
+				fprintf(stderr, "socket-server : udp (%d) type mismatch.\n", s->id);
+				drop_udp(ss, s, list, tmp);
+				break;
+			}
+			iov[n].iov_base = tmp->ptr;
+			iov[n].iov_len = tmp->sz;
+			memset(&msg[n].msg_hdr, 0, sizeof(msg[n].msg_hdr));
+			msg[n].msg_hdr.msg_name = &sa[n].s;
+			msg[n].msg_hdr.msg_namelen = sasz;
+			msg[n].msg_hdr.msg_iov = &iov[n];
+			msg[n].msg_hdr.msg_iovlen = 1;
+			++n;
+			tmp = tmp->next;
 		}
-		int err = sendto(s->fd, tmp->ptr, tmp->sz, 0, &sa.s, sasz);
-		if (err < 0) {
+		if (n == 0) {
+			// the head is dropped
+			continue;
+		}
+		int sent = sendmmsg(s->fd, msg, n, 0);
+		if (sent < 0) {
 			switch(errno) {
 			case EINTR:
+				continue;
 			case AGAIN_WOULDBLOCK:
 				return -1;
 			}
 			fprintf(stderr, "socket-server : udp (%d) sendto error %s.\n",s->id, strerror(errno));
-			drop_udp(ss, s, list, tmp);
-			return -1;
+			drop_udp(ss, s, list, list->head);
+			continue;
+		}
+		int i;
+		for (i=0;i<sent;i++) {
+			tmp = list->head;
+			stat_write(ss,s,tmp->sz);
+			s->wb_size -= tmp->sz;
+			list->head = tmp->next;
+			write_buffer_free(ss,tmp);
 		}
-		stat_write(ss,s,tmp->sz);
-		s->wb_size -= tmp->sz;
-		list->head = tmp->next;
-		write_buffer_free(ss,tmp);
+		// when sent < n, the next sendmmsg returns EAGAIN or the error of the next one.
 	}
 	list->tail = NULL;
 
@@ -751,9 +1242,9 @@ send_buffer_(struct socket_server *ss, struct socket *s, struct socket_lock *l,
 		} 
 		// step 4
 		assert(send_buffer_empty(s) && s->wb_size == 0);
-		sp_write(ss->event_fd, s->fd, s, false);			
+		enable_write(ss, s, false);			
 
-		if (s->type == SOCKET_TYPE_HALFCLOSE) {
+		if (s->type == SOCKET_TYPE_HALFCLOSE && s->zc.head == NULL) {
 				force_close(ss, s, l, result);
 				return SOCKET_CLOSE;
 		}
@@ -770,18 +1261,35 @@ send_buffer_(struct socket_server *ss, struct socket *s, struct socket_lock *l,
 	return -1;
 }
 
+// size is SIZEOF_TCPBUFFER or SIZEOF_UDPBUFFER, the tcp buffer has no udp_address.
+static struct write_buffer *
+write_buffer_new(struct socket_server *ss, void *buffer, int sz, int size) {
+	struct write_buffer * buf = MALLOC(size);
+	struct send_object so;
+	buf->userobject = send_object_init(ss, &so, buffer, sz);
+	buf->ptr = (char*)so.buffer;
+	buf->sz = so.sz;
+	buf->buffer = buffer;
+	buf->zcsent = false;
+	buf->fd = -1;
+	buf->next = NULL;
+	return buf;
+}
+
 static int
 send_buffer(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message *result) {
+#ifdef SP_EDGE_TRIGGER
+	// the write event will not come again, wait the direct write (it's short).
+	socket_lock(l);
+#else
 	if (!socket_trylock(l))
 		return -1;	// blocked by direct write, send later.
+#endif
 	if (s->dw_buffer) {
 		// add direct write buffer before high.head
-		struct write_buffer * buf = MALLOC(SIZEOF_TCPBUFFER);
-		struct send_object so;
-		buf->userobject = send_object_init(ss, &so, (void *)s->dw_buffer, s->dw_size);
-		buf->ptr = (char*)so.buffer+s->dw_offset;
-		buf->sz = so.sz - s->dw_offset;
-		buf->buffer = (void *)s->dw_buffer;
+		struct write_buffer * buf = write_buffer_new(ss, (void *)s->dw_buffer, s->dw_size, SIZEOF_TCPBUFFER);
+		buf->ptr += s->dw_offset;
+		buf->sz -= s->dw_offset;
 		s->wb_size+=buf->sz;
 		if (s->high.head == NULL) {
 			s->high.head = s->high.tail = buf;
@@ -800,13 +1308,7 @@ send_buffer(struct socket_server *ss, struct socket *s, struct socket_lock *l, s
 
 static struct write_buffer *
 append_sendbuffer_(struct socket_server *ss, struct wb_list *s, struct request_send * request, int size) {
-	struct write_buffer * buf = MALLOC(size);
-	struct send_object so;
-	buf->userobject = send_object_init(ss, &so, request->buffer, request->sz);
-	buf->ptr = (char*)so.buffer;
-	buf->sz = so.sz;
-	buf->buffer = request->buffer;
-	buf->next = NULL;
+	struct write_buffer * buf = write_buffer_new(ss, request->buffer, request->sz, size);
 	if (s->head == NULL) {
 		s->head = s->tail = buf;
 	} else {
@@ -839,6 +1341,19 @@ append_sendbuffer_low(struct socket_server *ss,struct socket *s, struct request_
 }
 
 
+static int
+send_warning(struct socket *s, struct socket_message *result) {
+	if (s->wb_size >= WARNING_SIZE && s->wb_size >= s->warn_size) {
+		s->warn_size = s->warn_size == 0 ? WARNING_SIZE *2 : s->warn_size*2;
+		result->opaque = s->opaque;
+		result->id = s->id;
+		result->ud = s->wb_size%1024 == 0 ? s->wb_size/1024 : s->wb_size/1024 + 1;
+		result->data = NULL;
+		return SOCKET_WARNING;
+	}
+	return -1;
+}
+
 /*
 	When send a package , we can assign the priority : PRIORITY_HIGH or PRIORITY_LOW
 
@@ -888,7 +1403,7 @@ send_socket(struct socket_server *ss, struct request_send * request, struct sock
 				return -1;
 			}
 		}
-		sp_write(ss->event_fd, s->fd, s, true);
+		enable_write(ss, s, true);
 	} else {
 		if (s->protocol == PROTOCOL_TCP) {
 			if (priority == PRIORITY_LOW) {
@@ -903,15 +1418,44 @@ send_socket(struct socket_server *ss, struct request_send * request, struct sock
 			append_sendbuffer_udp(ss,s,priority,request,udp_address);
 		}
 	}
-	if (s->wb_size >= WARNING_SIZE && s->wb_size >= s->warn_size) {
-		s->warn_size = s->warn_size == 0 ? WARNING_SIZE *2 : s->warn_size*2;
-		result->opaque = s->opaque;
-		result->id = s->id;
-		result->ud = s->wb_size%1024 == 0 ? s->wb_size/1024 : s->wb_size/1024 + 1;
-		result->data = NULL;
-		return SOCKET_WARNING;
+	return send_warning(s, result);
+}
+
+static int
+sendfile_socket(struct socket_server *ss, struct request_sendfile * request, struct socket_message *result) {
+	int id = request->id;
+	struct socket * s = &ss->slot[HASH_ID(id)];
+	if (s->type == SOCKET_TYPE_INVALID || s->id != id 
+		|| s->type == SOCKET_TYPE_HALFCLOSE
+		|| s->type == SOCKET_TYPE_PACCEPT
+		|| s->type == SOCKET_TYPE_PLISTEN
+		|| s->type == SOCKET_TYPE_LISTEN
+		|| s->protocol != PROTOCOL_TCP) {
+		close(request->fd);
+		return -1;
 	}
-	return -1;
+	// the file node is rare, allocate the whole struct (SIZEOF_TCPBUFFER is enough).
+	struct write_buffer * buf = MALLOC(sizeof(*buf));
+	buf->buffer = NULL;
+	buf->ptr = NULL;
+	buf->sz = request->sz;
+	buf->userobject = false;
+	buf->zcsent = false;
+	buf->fd = request->fd;
+	buf->offset = (off_t)request->offset;
+	buf->next = NULL;
+	if (send_buffer_empty(s) && s->type == SOCKET_TYPE_CONNECTED) {
+		enable_write(ss, s, true);
+	}
+	struct wb_list *list = &s->high;
+	if (list->head == NULL) {
+		list->head = list->tail = buf;
+	} else {
+		list->tail->next = buf;
+		list->tail = buf;
+	}
+	s->wb_size += buf->sz;
+	return send_warning(s, result);
 }
 
 static int
@@ -937,7 +1481,7 @@ _failed:
 
 static inline int
 nomore_sending_data(struct socket *s) {
-	return send_buffer_empty(s) && s->dw_buffer == NULL && (s->sending & 0xffff) == 0;
+	return send_buffer_empty(s) && s->zc.head == NULL && s->dw_buffer == NULL && (s->sending & 0xffff) == 0;
 }
 
 static int
@@ -1007,7 +1551,16 @@ start_socket(struct socket_server *ss, struct request_start *request, struct soc
 			result->data = strerror(errno);
 			return SOCKET_ERR;
 		}
+		s->reading = true;
+		s->writing = false;
+		if (s->paused) {
+			// paused before start
+			enable_read(ss, s, false);
+		}
 		s->type = (s->type == SOCKET_TYPE_PACCEPT) ? SOCKET_TYPE_CONNECTED : SOCKET_TYPE_LISTEN;
+		if (s->type == SOCKET_TYPE_CONNECTED) {
+			start_recv(ss, s);
+		}
 		s->opaque = request->opaque;
 		result->data = "start";
 		return SOCKET_OPEN;
@@ -1032,32 +1585,84 @@ setopt_socket(struct socket_server *ss, struct request_setopt *request) {
 	setsockopt(s->fd, IPPROTO_TCP, request->what, &v, sizeof(v));
 }
 
+// return 1 when the paused state of the reason changes
+static int
+pause_socket(struct socket_server *ss, int id, int reason, bool pause) {
+	struct socket *s = &ss->slot[HASH_ID(id)];
+	if (s->type == SOCKET_TYPE_INVALID || s->type == SOCKET_TYPE_RESERVE || s->id != id) {
+		return 0;
+	}
+	uint8_t paused = pause ? (s->paused | reason) : (s->paused & ~reason);
+	if (paused == s->paused) {
+		return 0;
+	}
+	s->paused = paused;
+	if (s->type != SOCKET_TYPE_PACCEPT && s->type != SOCKET_TYPE_PLISTEN) {
+		// the worker thread may enable write in socket_server_send, see enable_write
+		struct socket_lock l;
+		socket_lock_init(s, &l);
+		socket_lock(&l);
+		enable_read(ss, s, paused == 0);
+		socket_unlock(&l);
+	}
+	return 1;
+}
+
 static void
-block_readpipe(int pipefd, void *buffer, int sz) {
+zerocopy_socket(struct socket_server *ss, struct request_zerocopy *request) {
+	int id = request->id;
+	struct socket *s = &ss->slot[HASH_ID(id)];
+	if (s->type == SOCKET_TYPE_INVALID || s->id != id || s->protocol != PROTOCOL_TCP) {
+		return;
+	}
+#ifdef ZEROCOPY_SUPPORT
+	int one = 1;
+	if (setsockopt(s->fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0) {
+		s->zerocopy = true;
+	} else {
+		fprintf(stderr, "socket-server: socket (%d) can't enable zerocopy : %s.\n", id, strerror(errno));
+	}
+#endif
+}
+
+static void
+set_udp_batch(struct socket_server *ss, struct request_udpbatch *request) {
+	int id = request->id;
+	struct socket *s = &ss->slot[HASH_ID(id)];
+	if (s->type == SOCKET_TYPE_INVALID || s->id != id || s->protocol == PROTOCOL_TCP) {
+		return;
+	}
+	s->udpbatch = request->enable != 0;
+}
+
+// returns 1 when the wakeup signal is consumed
+static int
+ctrl_signal_reset(int fd) {
+	char tmp[64];
 	for (;;) {
-		int n = read(pipefd, buffer, sz);
+		// eventfd reads the 8 bytes counter, pipe reads the bytes written
+		ssize_t n = read(fd, tmp, sizeof(tmp));
 		if (n<0) {
 			if (errno == EINTR)
 				continue;
-			fprintf(stderr, "socket-server : read pipe error %s.\n",strerror(errno));
-			return;
+			// the producer set notify, but hasn't written yet.
+			return 0;
 		}
-		// must atomic read from a pipe
-		assert(n == sz);
-		return;
+		return 1;
 	}
 }
 
 static int
 has_cmd(struct socket_server *ss) {
-	struct timeval tv = {0,0};
-	int retval;
-
-	FD_SET(ss->recvctrl_fd, &ss->rfds);
-
-	retval = select(ss->recvctrl_fd+1, &ss->rfds, NULL, NULL, &tv);
-	if (retval == 1) {
+	struct ctrl_ring *r = ss->ctrl;
+	struct ctrl_slot *slot = &r->slot[r->head % CTRL_RING_SIZE];
+	if (slot->seq == r->head + 1)
 		return 1;
+	if (r->notify && ctrl_signal_reset(ss->recvctrl_fd)) {
+		r->notify = 0;
+		__sync_synchronize();
+		// a request may be published before notify is reset
+		return slot->seq == r->head + 1;
 	}
 	return 0;
 }
@@ -1142,14 +1747,19 @@ dec_sending_ref(struct socket_server *ss, int id) {
 // return type
 static int
 ctrl_cmd(struct socket_server *ss, struct socket_message *result) {
-	int fd = ss->recvctrl_fd;
-	// the length of message is one byte, so 256+8 buffer size is enough.
+	struct ctrl_ring *r = ss->ctrl;
+	uint32_t pos = r->head;
+	struct ctrl_slot *slot = &r->slot[pos % CTRL_RING_SIZE];
+	// has_cmd checked the slot is published
+	__sync_synchronize();
+	// the length of message is one byte, so 256 buffer size is enough.
 	uint8_t buffer[256];
-	uint8_t header[2];
-	block_readpipe(fd, header, sizeof(header));
-	int type = header[0];
-	int len = header[1];
-	block_readpipe(fd, buffer, len);
+	int type = slot->type;
+	int len = slot->len;
+	memcpy(buffer, slot->buffer, len);
+	__sync_synchronize();
+	slot->seq = pos + CTRL_RING_SIZE;
+	r->head = pos + 1;
 	// ctrl command only exist in local fd, so don't worry about endian.
 	switch (type) {
 	case 'S':
@@ -1185,6 +1795,23 @@ ctrl_cmd(struct socket_server *ss, struct socket_message *result) {
 	case 'T':
 		setopt_socket(ss, (struct request_setopt *)buffer);
 		return -1;
+	case 'M':
+		set_udp_batch(ss, (struct request_udpbatch *)buffer);
+		return -1;
+	case 'Z':
+		zerocopy_socket(ss, (struct request_zerocopy *)buffer);
+		return -1;
+	case 'R': {
+		struct request_pause * request = (struct request_pause *) buffer;
+		pause_socket(ss, request->id, request->reason, request->pause != 0);
+		return -1;
+	}
+	case 'F': {
+		struct request_sendfile * request = (struct request_sendfile *) buffer;
+		int ret = sendfile_socket(ss, request, result);
+		dec_sending_ref(ss, request->id);
+		return ret;
+	}
 	case 'U':
 		add_udp_socket(ss, (struct request_udp *)buffer);
 		return -1;
@@ -1196,11 +1823,39 @@ ctrl_cmd(struct socket_server *ss, struct socket_message *result) {
 	return -1;
 }
 
+#ifdef SP_EDGE_TRIGGER
+
+/*
+	The buffer (n bytes) is full, read the rest into a larger buffer (at most MAX_DRAIN_BUFFER) as one message.
+	The caller handles the event again until EAGAIN (or eof), the edge is reported only once.
+ */
+static int
+read_drain(struct socket *s, char **buffer, int n) {
+	int cap = n;
+	while (n == cap && cap < MAX_DRAIN_BUFFER) {
+		cap *= 2;
+		*buffer = skynet_realloc(*buffer, cap);
+		int r;
+		do {
+			r = (int)read(s->fd, *buffer + n, cap - n);
+		} while (r < 0 && errno == EINTR);
+		if (r <= 0) {
+			// EAGAIN, or the eof (error) is reported by the next read
+			break;
+		}
+		n += r;
+	}
+	return n;
+}
+
+#endif
+
 // return -1 (ignore) when error
 static int
-forward_message_tcp(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message * result) {
+forward_message_tcp(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message * result, bool *more) {
 	int sz = s->p.size;
-	char * buffer = MALLOC(sz);
+	// p.size is always power of 2, it's the size class of the pooled buffer
+	char * buffer = skynet_malloc_pooled(sz);
 	int n = (int)read(s->fd, buffer, sz);
 	if (n<0) {
 		FREE(buffer);
@@ -1208,7 +1863,10 @@ forward_message_tcp(struct socket_server *ss, struct socket *s, struct socket_lo
 		case EINTR:
 			break;
 		case AGAIN_WOULDBLOCK:
+#ifndef SP_EDGE_TRIGGER
+			// edge triggered : the data of a queued edge may be drained by the last read already.
 			fprintf(stderr, "socket-server: EAGAIN capture.\n");
+#endif
 			break;
 		default:
 			// close when error
@@ -1227,12 +1885,23 @@ forward_message_tcp(struct socket_server *ss, struct socket *s, struct socket_lo
 	if (s->type == SOCKET_TYPE_HALFCLOSE) {
 		// discard recv data
 		FREE(buffer);
+#ifdef SP_EDGE_TRIGGER
+		*more = true;
+#endif
 		return -1;
 	}
 
+#ifdef SP_EDGE_TRIGGER
+	if (n == sz) {
+		n = read_drain(s, &buffer, n);
+	}
+	// read again until EAGAIN, even after a short read : the FIN may come with the last data in the same edge.
+	*more = true;
+#endif
+
 	stat_read(ss,s,n);
 
-	if (n == sz) {
+	if (n >= sz && sz < MAX_READ_BUFFER) {
 		s->p.size *= 2;
 	} else if (sz > MIN_READ_BUFFER && n*2 < sz) {
 		s->p.size /= 2;
@@ -1245,6 +1914,38 @@ forward_message_tcp(struct socket_server *ss, struct socket *s, struct socket_lo
 	return SOCKET_DATA;
 }
 
+#ifdef SP_RECV
+
+// the data is read by the poll backend already (e->data), copy it into the message.
+static int
+forward_message_recv(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message * result, struct event *e) {
+	int n = e->size;
+	if (n < 0) {
+		force_close(ss, s, l, result);
+		result->data = strerror(-n);
+		return SOCKET_ERR;
+	}
+	if (n == 0) {
+		force_close(ss, s, l, result);
+		return SOCKET_CLOSE;
+	}
+	if (s->type == SOCKET_TYPE_HALFCLOSE) {
+		// discard recv data
+		return -1;
+	}
+	char * buffer = MALLOC(n);
+	memcpy(buffer, e->data, n);
+	stat_read(ss,s,n);
+
+	result->opaque = s->opaque;
+	result->id = s->id;
+	result->ud = n;
+	result->data = buffer;
+	return SOCKET_DATA;
+}
+
+#endif
+
 static int
 gen_udp_address(int protocol, union sockaddr_all *sa, uint8_t * udp_address) {
 	int addrsz = 1;
@@ -1263,46 +1964,127 @@ gen_udp_address(int protocol, union sockaddr_all *sa, uint8_t * udp_address) {
 	return addrsz;
 }
 
-static int
-forward_message_udp(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message * result) {
-	union sockaddr_all sa;
-	socklen_t slen = sizeof(sa);
-	int n = recvfrom(s->fd, ss->udpbuffer,MAX_UDP_PACKAGE,0,&sa.s,&slen);
-	if (n<0) {
-		switch(errno) {
-		case EINTR:
-		case AGAIN_WOULDBLOCK:
-			break;
-		default:
-			// close when error
-			force_close(ss, s, l, result);
-			result->data = strerror(errno);
-			return SOCKET_ERR;
+static struct udp_ring *
+get_udp_ring(struct socket_server *ss) {
+	struct udp_ring *u = ss->udp;
+	if (u == NULL) {
+		u = MALLOC(sizeof(*u));
+		memset(u, 0, sizeof(*u));
+		u->buffer = MALLOC(UDP_BATCH * MAX_UDP_PACKAGE);
+		int i;
+		for (i=0;i<UDP_BATCH;i++) {
+			u->iov[i].iov_base = u->buffer + i * MAX_UDP_PACKAGE;
+			u->iov[i].iov_len = MAX_UDP_PACKAGE;
+			u->msg[i].msg_hdr.msg_name = &u->addr[i].s;
+			u->msg[i].msg_hdr.msg_iov = &u->iov[i];
+			u->msg[i].msg_hdr.msg_iovlen = 1;
 		}
-		return -1;
+		ss->udp = u;
 	}
-	stat_read(ss,s,n);
+	return u;
+}
 
-	uint8_t * data;
-	if (slen == sizeof(sa.v4)) {
-		if (s->protocol != PROTOCOL_UDP)
-			return -1;
-		data = MALLOC(n + 1 + 2 + 4);
-		gen_udp_address(PROTOCOL_UDP, &sa, data + n);
-	} else {
-		if (s->protocol != PROTOCOL_UDPv6)
-			return -1;
-		data = MALLOC(n + 1 + 2 + 16);
-		gen_udp_address(PROTOCOL_UDPv6, &sa, data + n);
+// return protocol of the datagram i in ring, or PROTOCOL_UNKNOWN
+static inline int
+udp_protocol(struct udp_ring *u, int i) {
+	return u->msg[i].msg_hdr.msg_namelen == sizeof(u->addr[i].v4) ? PROTOCOL_UDP : PROTOCOL_UDPv6;
+}
+
+/*
+	Pack the datagrams left in ring into one buffer, each one is
+	[uint32 size][uint8 address size][address][data]
+ */
+static int
+forward_udp_batch(struct socket_server *ss, struct socket *s, struct udp_ring *u, struct socket_message * result) {
+	int i;
+	size_t size = 0;
+	for (i=u->index;i<u->n;i++) {
+		if (udp_protocol(u, i) == s->protocol) {
+			size += sizeof(uint32_t) + 1 + (s->protocol == PROTOCOL_UDP ? 1+2+4 : 1+2+16) + u->msg[i].msg_len;
+		}
+	}
+	if (size == 0) {
+		u->index = u->n;
+		return -1;
 	}
-	memcpy(data, ss->udpbuffer, n);
+	uint8_t * data = MALLOC(size);
+	uint8_t * ptr = data;
+	for (i=u->index;i<u->n;i++) {
+		if (udp_protocol(u, i) != s->protocol)
+			continue;
+		uint32_t n = u->msg[i].msg_len;
+		stat_read(ss,s,n);
+		memcpy(ptr, &n, sizeof(n));
+		ptr += sizeof(n);
+		int addrsz = gen_udp_address(s->protocol, &u->addr[i], ptr + 1);
+		ptr[0] = (uint8_t)addrsz;
+		ptr += 1 + addrsz;
+		memcpy(ptr, u->iov[i].iov_base, n);
+		ptr += n;
+	}
+	u->index = u->n;
 
 	result->opaque = s->opaque;
 	result->id = s->id;
-	result->ud = n;
+	result->ud = (int)size;
 	result->data = (char *)data;
 
-	return SOCKET_UDP;
+	return SOCKET_UDP_BATCH;
+}
+
+/*
+	Read up to UDP_BATCH datagrams by one recvmmsg, and then forward them one by one (SOCKET_UDP),
+	or all in one message (SOCKET_UDP_BATCH) when the socket is in batch mode.
+ */
+static int
+forward_message_udp(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message * result) {
+	struct udp_ring *u = get_udp_ring(ss);
+	if (u->index >= u->n || u->id != s->id) {
+		int i;
+		for (i=0;i<UDP_BATCH;i++) {
+			u->msg[i].msg_hdr.msg_namelen = sizeof(u->addr[i]);
+		}
+		u->index = u->n = 0;
+		int n = recvmmsg(s->fd, u->msg, UDP_BATCH, 0, NULL);
+		if (n<0) {
+			switch(errno) {
+			case EINTR:
+			case AGAIN_WOULDBLOCK:
+				break;
+			default:
+				// close when error
+				force_close(ss, s, l, result);
+				result->data = strerror(errno);
+				return SOCKET_ERR;
+			}
+			return -1;
+		}
+		u->id = s->id;
+		u->n = n;
+	}
+	if (s->udpbatch) {
+		return forward_udp_batch(ss, s, u, result);
+	}
+
+	while (u->index < u->n) {
+		int i = u->index++;
+		int protocol = udp_protocol(u, i);
+		if (protocol != s->protocol)
+			continue;
+		int n = u->msg[i].msg_len;
+		stat_read(ss,s,n);
+		uint8_t * data = MALLOC(n + (protocol == PROTOCOL_UDP ? 1+2+4 : 1+2+16));
+		gen_udp_address(protocol, &u->addr[i], data + n);
+		memcpy(data, u->iov[i].iov_base, n);
+
+		result->opaque = s->opaque;
+		result->id = s->id;
+		result->ud = n;
+		result->data = (char *)data;
+
+		return SOCKET_UDP;
+	}
+	return -1;
 }
 
 static int
@@ -1319,11 +2101,12 @@ report_connect(struct socket_server *ss, struct socket *s, struct socket_lock *l
 		return SOCKET_ERR;
 	} else {
 		s->type = SOCKET_TYPE_CONNECTED;
+		start_recv(ss, s);
 		result->opaque = s->opaque;
 		result->id = s->id;
 		result->ud = 0;
 		if (nomore_sending_data(s)) {
-			sp_write(ss->event_fd, s->fd, s, false);
+			enable_write(ss, s, false);
 		}
 		union sockaddr_all u;
 		socklen_t slen = sizeof(u);
@@ -1357,30 +2140,55 @@ getname(union sockaddr_all *u, char *buffer, size_t sz) {
 static int
 report_accept(struct socket_server *ss, struct socket *s, struct socket_message *result) {
 	union sockaddr_all u;
-	socklen_t len = sizeof(u);
-	int client_fd = accept(s->fd, &u.s, &len);
-	if (client_fd < 0) {
-		if (errno == EMFILE || errno == ENFILE) {
-			result->opaque = s->opaque;
-			result->id = s->id;
-			result->ud = 0;
-			result->data = strerror(errno);
-			return -1;
-		} else {
-			return 0;
+	socklen_t len;
+	int client_fd;
+	int id;
+	struct socket *ns;
+	for (;;) {
+		len = sizeof(u);
+#ifdef __linux__
+		client_fd = accept4(s->fd, &u.s, &len, SOCK_NONBLOCK);
+#else
+		client_fd = accept(s->fd, &u.s, &len);
+#endif
+		if (client_fd < 0) {
+			// the aborted connection is discarded, try the next one.
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			if (errno == EMFILE || errno == ENFILE) {
+				result->opaque = s->opaque;
+				result->id = s->id;
+				result->ud = 0;
+				result->data = strerror(errno);
+				return -1;
+			} else {
+				return 0;
+			}
+		}
+		// spread the connections over the group. The new socket isn't added to the event pool until
+		// socket_server_start, which is sent to the shard of its id.
+		struct socket_server *target = ss;
+		if (ss->shard_count > 1) {
+			target = ss->group[ss->accept_index];
+			if (++ss->accept_index >= ss->shard_count) {
+				ss->accept_index = 0;
+			}
+		}
+		id = reserve_id(target);
+		if (id >= 0) {
+			socket_keepalive(client_fd);
+#ifndef __linux__
+			sp_nonblocking(client_fd);
+#endif
+			ns = new_fd(target, id, client_fd, PROTOCOL_TCP, s->opaque, false);
+			if (ns)
+				break;
 		}
-	}
-	int id = reserve_id(ss);
-	if (id < 0) {
-		close(client_fd);
-		return 0;
-	}
-	socket_keepalive(client_fd);
-	sp_nonblocking(client_fd);
-	struct socket *ns = new_fd(ss, id, client_fd, PROTOCOL_TCP, s->opaque, false);
-	if (ns == NULL) {
 		close(client_fd);
+#ifndef SP_EDGE_TRIGGER
 		return 0;
+#endif
+		// edge triggered : the edge isn't reported again, drop this one and accept the next one until EAGAIN.
 	}
 	// accept new one connection
 	stat_read(ss,s,1);
@@ -1416,7 +2224,23 @@ clear_closed_event(struct socket_server *ss, struct socket_message * result, int
 	}
 }
 
-// return type
+// the socket may have more to read (edge triggered), handle it again after the other events and requests,
+// so one fast peer can't take over the thread.
+static void
+requeue_event(struct socket_server *ss, struct event *e) {
+	struct event tmp = *e;
+	if (ss->event_n == MAX_EVENT) {
+		// the events before event_index are handled
+		int n = ss->event_n - ss->event_index;
+		memmove(ss->ev, ss->ev + ss->event_index, n * sizeof(struct event));
+		ss->event_index = 0;
+		ss->event_n = n;
+	}
+	ss->ev[ss->event_n++] = tmp;
+	ss->checkctrl = 1;
+}
+
+// return type, SOCKET_IDLE when *more is 0 and there is no event (it doesn't wait)
 int 
 socket_server_poll(struct socket_server *ss, struct socket_message * result, int * more) {
 	for (;;) {
@@ -1433,6 +2257,10 @@ socket_server_poll(struct socket_server *ss, struct socket_message * result, int
 			}
 		}
 		if (ss->event_index == ss->event_n) {
+			if (more && *more == 0) {
+				// the caller handles a batch of events, don't block it.
+				return SOCKET_IDLE;
+			}
 			ss->event_n = sp_wait(ss->event_fd, ss->ev, MAX_EVENT);
 			ss->checkctrl = 1;
 			if (more) {
@@ -1461,8 +2289,16 @@ socket_server_poll(struct socket_server *ss, struct socket_message * result, int
 		case SOCKET_TYPE_LISTEN: {
 			int ok = report_accept(ss, s, result);
 			if (ok > 0) {
+#ifdef SP_EDGE_TRIGGER
+				// accept until EAGAIN
+				requeue_event(ss, e);
+#endif
 				return SOCKET_ACCEPT;
 			} if (ok < 0 ) {
+#ifdef SP_EDGE_TRIGGER
+				// the pending connections don't trigger a new edge, EPOLL_CTL_MOD reports them again.
+				sp_enable(ss->event_fd, s->fd, s, s->reading, s->writing);
+#endif
 				return SOCKET_ERR;
 			}
 			// when ok == 0, retry
@@ -1472,16 +2308,39 @@ socket_server_poll(struct socket_server *ss, struct socket_message * result, int
 			fprintf(stderr, "socket-server: invalid socket\n");
 			break;
 		default:
+#ifdef ZEROCOPY_SUPPORT
+			if (e->error && s->zcseq && zerocopy_complete(ss, s)) {
+				// the completions of MSG_ZEROCOPY, not an error. They may come with read or write.
+				e->error = false;
+				if (s->type == SOCKET_TYPE_HALFCLOSE && s->zc.head == NULL && send_buffer_empty(s)) {
+					force_close(ss, s, &l, result);
+					return SOCKET_CLOSE;
+				}
+			}
+#endif
 			if (e->read) {
 				int type;
+#ifdef SP_RECV
+				if (e->recv) {
+					type = forward_message_recv(ss, s, &l, result, e);
+				} else
+#endif
 				if (s->protocol == PROTOCOL_TCP) {
-					type = forward_message_tcp(ss, s, &l, result);
+					bool more = false;
+					type = forward_message_tcp(ss, s, &l, result, &more);
+					if (more) {
+						// read again until EAGAIN (edge triggered)
+						requeue_event(ss, e);
+						if (type == -1)
+							break;
+						return type;
+					}
 				} else {
 					type = forward_message_udp(ss, s, &l, result);
-					if (type == SOCKET_UDP) {
+					if (type == SOCKET_UDP || type == SOCKET_UDP_BATCH) {
 						// try read again
 						--ss->event_index;
-						return SOCKET_UDP;
+						return type;
 					}
 				}
 				if (e->write && type != SOCKET_CLOSE && type != SOCKET_ERR) {
@@ -1526,22 +2385,53 @@ socket_server_poll(struct socket_server *ss, struct socket_message * result, int
 }
 
 static void
-send_request(struct socket_server *ss, struct request_package *request, char type, int len) {
-	request->header[6] = (uint8_t)type;
-	request->header[7] = (uint8_t)len;
+ctrl_signal(int fd) {
+#ifdef __linux__
+	uint64_t v = 1;
+#else
+	char v = 0;
+#endif
 	for (;;) {
-		ssize_t n = write(ss->sendctrl_fd, &request->header[6], len+2);
+		ssize_t n = write(fd, &v, sizeof(v));
 		if (n<0) {
 			if (errno != EINTR) {
-				fprintf(stderr, "socket-server : send ctrl command error %s.\n", strerror(errno));
+				fprintf(stderr, "socket-server : send ctrl signal error %s.\n", strerror(errno));
+				return;
 			}
 			continue;
 		}
-		assert(n == len+2);
 		return;
 	}
 }
 
+static void
+send_request(struct socket_server *ss, struct request_package *request, char type, int len) {
+	struct ctrl_ring *r = ss->ctrl;
+	struct ctrl_slot *slot;
+	uint32_t pos = r->tail;
+	for (;;) {
+		slot = &r->slot[pos % CTRL_RING_SIZE];
+		int32_t diff = (int32_t)(slot->seq - pos);
+		if (diff == 0) {
+			if (ATOM_CAS(&r->tail, pos, pos + 1))
+				break;
+		} else if (diff < 0) {
+			// the ring is full, wait the socket thread (as a blocking pipe write)
+			sched_yield();
+		}
+		pos = r->tail;
+	}
+	slot->type = (uint8_t)type;
+	slot->len = (uint8_t)len;
+	memcpy(slot->buffer, &request->u, len);
+	__sync_synchronize();
+	slot->seq = pos + 1;
+	__sync_synchronize();
+	if (r->notify == 0 && ATOM_CAS(&r->notify, 0, 1)) {
+		ctrl_signal(ss->sendctrl_fd);
+	}
+}
+
 static int
 open_request(struct socket_server *ss, struct request_package *req, uintptr_t opaque, const char *addr, int port) {
 	int len = strlen(addr);
@@ -1576,6 +2466,17 @@ can_direct_write(struct socket *s, int id) {
 	return s->id == id && nomore_sending_data(s) && s->type == SOCKET_TYPE_CONNECTED && s->udpconnecting == 0;
 }
 
+// the large buffers of a zerocopy socket are sent by the socket thread
+static inline int
+zerocopy_send(struct socket_server *ss, struct socket *s, const void * buffer, int sz) {
+	if (!s->zerocopy)
+		return 0;
+	if (sz < 0) {
+		sz = ss->soi.size((void *)buffer);
+	}
+	return sz >= ZEROCOPY_SIZE;
+}
+
 // return -1 when error, 0 when success
 int 
 socket_server_send(struct socket_server *ss, int id, const void * buffer, int sz) {
@@ -1588,7 +2489,7 @@ socket_server_send(struct socket_server *ss, int id, const void * buffer, int sz
 	struct socket_lock l;
 	socket_lock_init(s, &l);
 
-	if (can_direct_write(s,id) && socket_trylock(&l)) {
+	if (can_direct_write(s,id) && !zerocopy_send(ss, s, buffer, sz) && socket_trylock(&l)) {
 		// may be we can send directly, double check
 		if (can_direct_write(s,id)) {
 			// send directly
@@ -1624,7 +2525,7 @@ socket_server_send(struct socket_server *ss, int id, const void * buffer, int sz
 			s->dw_size = sz;
 			s->dw_offset = n;
 
-			sp_write(ss->event_fd, s->fd, s, true);
+			enable_write(ss, s, true);
 
 			socket_unlock(&l);
 			return 0;
@@ -1663,6 +2564,57 @@ socket_server_send_lowpriority(struct socket_server *ss, int id, const void * bu
 	return 0;
 }
 
+int
+socket_server_sendfile(struct socket_server *ss, int id, int fd, int64_t offset, int sz) {
+	struct socket * s = &ss->slot[HASH_ID(id)];
+	if (s->id != id || s->type == SOCKET_TYPE_INVALID) {
+		close(fd);
+		return -1;
+	}
+
+	inc_sending_ref(s, id);
+
+	struct request_package request;
+	request.u.sendfile.id = id;
+	request.u.sendfile.fd = fd;
+	request.u.sendfile.sz = sz;
+	request.u.sendfile.offset = offset;
+
+	send_request(ss, &request, 'F', sizeof(request.u.sendfile));
+	return 0;
+}
+
+static void
+pause_request(struct socket_server *ss, int id, int reason, int pause) {
+	struct request_package request;
+	request.u.pause.id = id;
+	request.u.pause.reason = reason;
+	request.u.pause.pause = pause;
+	send_request(ss, &request, 'R', sizeof(request.u.pause));
+}
+
+void
+socket_server_pause(struct socket_server *ss, int id, int reason) {
+	pause_request(ss, id, reason, 1);
+}
+
+void
+socket_server_resume(struct socket_server *ss, int id, int reason) {
+	pause_request(ss, id, reason, 0);
+}
+
+int
+socket_server_pause_local(struct socket_server *ss, int id, int reason) {
+	return pause_socket(ss, id, reason, true);
+}
+
+void
+socket_server_zerocopy(struct socket_server *ss, int id) {
+	struct request_package request;
+	request.u.zerocopy.id = id;
+	send_request(ss, &request, 'Z', sizeof(request.u.zerocopy));
+}
+
 void
 socket_server_exit(struct socket_server *ss) {
 	struct request_package request;
@@ -1757,6 +2709,8 @@ do_listen(const char * host, int port, int backlog) {
 		close(listen_fd);
 		return -1;
 	}
+	// accept until EAGAIN (edge triggered), and never block the socket thread when the connection is aborted.
+	sp_nonblocking(listen_fd);
 	return listen_fd;
 }
 
@@ -1809,6 +2763,14 @@ socket_server_nodelay(struct socket_server *ss, int id) {
 	send_request(ss, &request, 'T', sizeof(request.u.setopt));
 }
 
+void
+socket_server_udp_batch(struct socket_server *ss, int id, int enable) {
+	struct request_package request;
+	request.u.udpbatch.id = id;
+	request.u.udpbatch.enable = enable;
+	send_request(ss, &request, 'M', sizeof(request.u.udpbatch));
+}
+
 void 
 socket_server_userobject(struct socket_server *ss, struct socket_object_interface *soi) {
 	ss->soi = *soi;
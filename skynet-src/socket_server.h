@@ -12,6 +12,8 @@
 #define SOCKET_EXIT 5
 #define SOCKET_UDP 6
 #define SOCKET_WARNING 7
+#define SOCKET_UDP_BATCH 8
+#define SOCKET_IDLE 9
 
 struct socket_server;
 
@@ -23,8 +25,14 @@ struct socket_message {
 };
 
 struct socket_server * socket_server_create(uint64_t time);
+// shard the sockets across count socket servers, each one is polled by its own thread.
+// the accepted connections of a listening socket are spread over the group.
+void socket_server_group(struct socket_server **group, int count);
+// which server (index of the group) the socket id belongs to
+int socket_server_shard(int id, int count);
 void socket_server_release(struct socket_server *);
 void socket_server_updatetime(struct socket_server *, uint64_t time);
+// *more is set to 0 when it waits for new events. If *more is 0 already, it returns SOCKET_IDLE instead of waiting.
 int socket_server_poll(struct socket_server *, struct socket_message *result, int *more);
 
 void socket_server_exit(struct socket_server *);
@@ -35,14 +43,29 @@ void socket_server_start(struct socket_server *, uintptr_t opaque, int id);
 // return -1 when error
 int socket_server_send(struct socket_server *, int id, const void * buffer, int sz);
 int socket_server_send_lowpriority(struct socket_server *, int id, const void * buffer, int sz);
+// send sz bytes of the file from offset, the fd is closed by socket server after sending (or when error)
+int socket_server_sendfile(struct socket_server *, int id, int fd, int64_t offset, int sz);
 
 // ctrl command below returns id
 int socket_server_listen(struct socket_server *, uintptr_t opaque, const char * addr, int port, int backlog);
 int socket_server_connect(struct socket_server *, uintptr_t opaque, const char * addr, int port);
 int socket_server_bind(struct socket_server *, uintptr_t opaque, int fd);
 
+#define SOCKET_PAUSE_USER 1	// by the service
+#define SOCKET_PAUSE_QUEUE 2	// the message queue of the service is too long
+
+// stop reading the socket (so the tcp backpressure reaches the peer), until all the reasons are resumed.
+void socket_server_pause(struct socket_server *, int id, int reason);
+void socket_server_resume(struct socket_server *, int id, int reason);
+// the same as socket_server_pause, but it can only be called in the poll thread of the server.
+// return 1 when the socket is paused for the reason now.
+int socket_server_pause_local(struct socket_server *, int id, int reason);
+
 // for tcp
 void socket_server_nodelay(struct socket_server *, int id);
+// send the large buffers by MSG_ZEROCOPY (linux 4.14+), they are freed when the kernel reports the completion.
+// It turns off by itself when the kernel copies the data anyway (such as loopback).
+void socket_server_zerocopy(struct socket_server *, int id);
 
 struct socket_udp_address;
 
@@ -54,6 +77,9 @@ int socket_server_udp_connect(struct socket_server *, int id, const char * addr,
 // If the socket_udp_address is NULL, use last call socket_server_udp_connect address instead
 // You can also use socket_server_send 
 int socket_server_udp_send(struct socket_server *, int id, const struct socket_udp_address *, const void *buffer, int sz);
+// receive the datagrams in batch : several datagrams in one SOCKET_UDP_BATCH message.
+// the data is [uint32 size][uint8 address size][address][data] ... , and ud is the size of data.
+void socket_server_udp_batch(struct socket_server *, int id, int enable);
 // extract the address of the message, struct socket_message * should be SOCKET_UDP
 const struct socket_udp_address * socket_server_udp_address(struct socket_server *, struct socket_message *, int *addrsz);
 
@@ -0,0 +1,721 @@
+#ifndef poll_socket_uring_h
+#define poll_socket_uring_h
+
+/*
+	io_uring poll backend (build with -DUSE_IO_URING), it falls back to epoll when io_uring is unavailable.
+
+	Each socket has a one-shot IORING_OP_POLL_ADD in flight. A completion is an event, and the poll is re-armed
+	at the next sp_wait, after the event is handled, so it's level triggered like epoll.
+	sp_add / sp_write / sp_del and the re-arms of the socket thread are queued in the submission ring, and they
+	are submitted by the same io_uring_enter which waits for the next events. So there is only one syscall
+	for a batch of events, instead of one epoll_wait and an epoll_ctl for every sp_write.
+	sp_write may be called by other threads (direct write of socket_server_send), they submit at once.
+
+	The connected tcp sockets (sp_recv) are read by a multishot IORING_OP_RECV with the buffers provided by
+	a buffer ring, instead of a poll and a read syscall. A completion is an event with the data (e->recv),
+	and the buffer is returned to the ring at the next sp_wait. The poll of such a socket is for POLLOUT
+	and POLLERR (the completions of MSG_ZEROCOPY) only.
+ */
+
+#include <netdb.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+
+#include "spinlock.h"
+
+#define SP_URING_ENTRIES 1024
+#define SP_URING_IGNORE ((uint64_t)-1)
+
+#ifdef IORING_RECV_MULTISHOT
+// socket_server calls sp_recv for the connected tcp sockets
+#define SP_RECV
+#endif
+
+// the buffer ring of IORING_OP_RECV, the number of buffers should be power of 2
+#define SP_URING_BGID 0
+#define SP_URING_BUFFERS 256
+#define SP_URING_BUFFER_SIZE 8192
+// the flag of the user_data of recv
+#define SP_URING_RECV 0x80000000u
+
+struct sp_uring_fd {
+	void * ud;
+	uint32_t gen;	// user_data is gen << 32 | fd, the completions of old generations are ignored
+	uint32_t rgen;	// the generation of recv
+	uint32_t events;
+	uint8_t active;
+	uint8_t armed;	// a poll is in flight
+	uint8_t queued;	// in rearm list
+	uint8_t recv;	// read by recv, see sp_recv
+	uint8_t recving;	// a multishot recv is in flight
+	uint8_t hup;	// POLLHUP is reported, recv reports the eof
+};
+
+struct sp_uring {
+	int ring;	// -1 : use epoll
+	int epoll;
+	struct spinlock lock;
+	pthread_t owner;	// the thread calls sp_wait
+	int has_owner;
+	// submission ring
+	unsigned * sq_head;
+	unsigned * sq_tail;
+	unsigned * sq_mask;
+	unsigned * sq_array;
+	struct io_uring_sqe * sqes;
+	// completion ring
+	unsigned * cq_head;
+	unsigned * cq_tail;
+	unsigned * cq_mask;
+	struct io_uring_cqe * cqes;
+	void * sq_ptr;
+	size_t sq_sz;
+	void * cq_ptr;
+	size_t cq_sz;
+	size_t sqes_sz;
+	// socket fds
+	struct sp_uring_fd * fds;
+	int fd_cap;
+	int * rearm;
+	int rearm_n;
+	int rearm_cap;
+	// provided buffers of recv, br is NULL when it's not supported
+	struct io_uring_buf_ring * br;
+	char * buffer;
+	uint16_t br_tail;
+	int norecv;	// multishot recv isn't supported
+	int hold[SP_URING_BUFFERS];	// the buffers of the events, returned at the next sp_wait
+	int hold_n;
+};
+
+static bool
+sp_invalid(struct sp_uring *u) {
+	return u == NULL;
+}
+
+static int
+uring_enter(int ring, unsigned submit, unsigned wait, unsigned flags) {
+	return (int)syscall(__NR_io_uring_enter, ring, submit, wait, flags, NULL, 0);
+}
+
+static int
+uring_setup(struct sp_uring *u) {
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	int ring = (int)syscall(__NR_io_uring_setup, SP_URING_ENTRIES, &p);
+	if (ring < 0)
+		return 1;
+	if (!(p.features & IORING_FEAT_NODROP)) {
+		// completions may be dropped when cq is overflow, use epoll instead
+		close(ring);
+		return 1;
+	}
+	u->sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	u->cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	u->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+	u->sq_ptr = mmap(NULL, u->sq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+	u->cq_ptr = mmap(NULL, u->cq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_CQ_RING);
+	u->sqes = mmap(NULL, u->sqes_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQES);
+	if (u->sq_ptr == MAP_FAILED || u->cq_ptr == MAP_FAILED || u->sqes == MAP_FAILED) {
+		if (u->sq_ptr != MAP_FAILED)
+			munmap(u->sq_ptr, u->sq_sz);
+		if (u->cq_ptr != MAP_FAILED)
+			munmap(u->cq_ptr, u->cq_sz);
+		if (u->sqes != MAP_FAILED)
+			munmap(u->sqes, u->sqes_sz);
+		close(ring);
+		return 1;
+	}
+	char * sq = u->sq_ptr;
+	u->sq_head = (unsigned *)(sq + p.sq_off.head);
+	u->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	u->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+	u->sq_array = (unsigned *)(sq + p.sq_off.array);
+	char * cq = u->cq_ptr;
+	u->cq_head = (unsigned *)(cq + p.cq_off.head);
+	u->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	u->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	u->ring = ring;
+	return 0;
+}
+
+static void
+uring_buffer_put(struct sp_uring *u, int bid) {
+	struct io_uring_buf *b = &u->br->bufs[u->br_tail & (SP_URING_BUFFERS - 1)];
+	b->addr = (uint64_t)(uintptr_t)(u->buffer + bid * SP_URING_BUFFER_SIZE);
+	b->len = SP_URING_BUFFER_SIZE;
+	b->bid = (uint16_t)bid;
+	++u->br_tail;
+}
+
+static void
+uring_buffer_commit(struct sp_uring *u) {
+	__sync_synchronize();
+	*(volatile uint16_t *)&u->br->tail = u->br_tail;
+}
+
+static void
+uring_buffer_setup(struct sp_uring *u) {
+#ifdef SP_RECV
+	size_t sz = SP_URING_BUFFERS * sizeof(struct io_uring_buf);
+	void * br = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+	if (br == MAP_FAILED)
+		return;
+	struct io_uring_buf_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uint64_t)(uintptr_t)br;
+	reg.ring_entries = SP_URING_BUFFERS;
+	reg.bgid = SP_URING_BGID;
+	if (syscall(__NR_io_uring_register, u->ring, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+		// the kernel is older than 5.19, use poll and read
+		munmap(br, sz);
+		return;
+	}
+	u->br = br;
+	u->buffer = skynet_malloc(SP_URING_BUFFERS * SP_URING_BUFFER_SIZE);
+	int i;
+	for (i=0;i<SP_URING_BUFFERS;i++) {
+		uring_buffer_put(u, i);
+	}
+	uring_buffer_commit(u);
+#endif
+}
+
+static struct sp_uring *
+sp_create() {
+	struct sp_uring * u = skynet_malloc(sizeof(*u));
+	memset(u, 0, sizeof(*u));
+	spinlock_init(&u->lock);
+	u->epoll = -1;
+	if (uring_setup(u)) {
+		u->ring = -1;
+		u->epoll = epoll_create(1024);
+		if (u->epoll == -1) {
+			spinlock_destroy(&u->lock);
+			skynet_free(u);
+			return NULL;
+		}
+	} else {
+		uring_buffer_setup(u);
+	}
+	return u;
+}
+
+static void
+sp_release(struct sp_uring *u) {
+	if (u->ring >= 0) {
+		munmap(u->sq_ptr, u->sq_sz);
+		munmap(u->cq_ptr, u->cq_sz);
+		munmap(u->sqes, u->sqes_sz);
+		close(u->ring);
+		if (u->br) {
+			munmap(u->br, SP_URING_BUFFERS * sizeof(struct io_uring_buf));
+			skynet_free(u->buffer);
+		}
+	} else {
+		close(u->epoll);
+	}
+	spinlock_destroy(&u->lock);
+	skynet_free(u->fds);
+	skynet_free(u->rearm);
+	skynet_free(u);
+}
+
+static inline int
+uring_is_owner(struct sp_uring *u) {
+	return u->has_owner && pthread_equal(u->owner, pthread_self());
+}
+
+// read the index updated by kernel
+static inline unsigned
+uring_load(unsigned *p) {
+	unsigned v = *(volatile unsigned *)p;
+	__sync_synchronize();
+	return v;
+}
+
+// sqes in the ring but not submitted yet
+static inline unsigned
+uring_pending(struct sp_uring *u) {
+	return *u->sq_tail - uring_load(u->sq_head);
+}
+
+// call with lock
+static void
+uring_submit(struct sp_uring *u) {
+	unsigned n = uring_pending(u);
+	while (n > 0 && uring_enter(u->ring, n, 0, 0) < 0) {
+		if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+			// the sqes are still in the ring, submit them next time
+			return;
+		}
+	}
+}
+
+// call with lock
+static struct io_uring_sqe *
+uring_sqe(struct sp_uring *u) {
+	unsigned tail = *u->sq_tail;
+	unsigned mask = *u->sq_mask;
+	if (tail - uring_load(u->sq_head) > mask) {
+		// submission ring is full
+		uring_submit(u);
+	}
+	unsigned idx = tail & mask;
+	struct io_uring_sqe * sqe = &u->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	u->sq_array[idx] = idx;
+	return sqe;
+}
+
+// call with lock
+static void
+uring_commit(struct sp_uring *u) {
+	__sync_synchronize();
+	*u->sq_tail = *u->sq_tail + 1;
+}
+
+static inline uint64_t
+uring_userdata(struct sp_uring_fd *f, int sock) {
+	return (uint64_t)f->gen << 32 | (uint32_t)sock;
+}
+
+// call with lock
+static void
+uring_arm(struct sp_uring *u, int sock) {
+	struct sp_uring_fd *f = &u->fds[sock];
+	struct io_uring_sqe * sqe = uring_sqe(u);
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = sock;
+	// recv reads the socket
+	sqe->poll32_events = f->recv ? (f->events & ~POLLIN) : f->events;
+	sqe->user_data = uring_userdata(f, sock);
+	uring_commit(u);
+	f->armed = 1;
+}
+
+// call with lock, cancel the poll in flight and start a new generation
+static void
+uring_disarm(struct sp_uring *u, int sock) {
+	struct sp_uring_fd *f = &u->fds[sock];
+	if (f->armed) {
+		struct io_uring_sqe * sqe = uring_sqe(u);
+		sqe->opcode = IORING_OP_POLL_REMOVE;
+		sqe->fd = -1;
+		sqe->addr = uring_userdata(f, sock);
+		sqe->user_data = SP_URING_IGNORE;
+		uring_commit(u);
+		f->armed = 0;
+	}
+	++f->gen;
+}
+
+// call with lock, start a multishot recv
+static void
+uring_arm_recv(struct sp_uring *u, int sock) {
+	struct sp_uring_fd *f = &u->fds[sock];
+	struct io_uring_sqe * sqe = uring_sqe(u);
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = sock;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = SP_URING_BGID;
+	sqe->user_data = (uint64_t)f->rgen << 32 | SP_URING_RECV | (uint32_t)sock;
+	uring_commit(u);
+	f->recving = 1;
+}
+
+// call with lock, cancel the recv in flight. The completions of it are ignored when new_gen is set,
+// or it's not recving until the last completion (without IORING_CQE_F_MORE).
+static void
+uring_cancel_recv(struct sp_uring *u, int sock, int new_gen) {
+	struct sp_uring_fd *f = &u->fds[sock];
+	if (f->recving) {
+		struct io_uring_sqe * sqe = uring_sqe(u);
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = -1;
+		sqe->addr = (uint64_t)f->rgen << 32 | SP_URING_RECV | (uint32_t)sock;
+		sqe->user_data = SP_URING_IGNORE;
+		uring_commit(u);
+		if (new_gen) {
+			f->recving = 0;
+		}
+	}
+	if (new_gen) {
+		++f->rgen;
+	}
+}
+
+static void
+uring_flush(struct sp_uring *u) {
+	if (!uring_is_owner(u) && uring_pending(u) > 0) {
+		// the socket thread may be blocked in sp_wait
+		uring_submit(u);
+	}
+}
+
+static int
+uring_reserve(struct sp_uring *u, int sock) {
+	if (sock >= u->fd_cap) {
+		int cap = u->fd_cap ? u->fd_cap : 1024;
+		while (cap <= sock)
+			cap *= 2;
+		struct sp_uring_fd * fds = skynet_malloc(cap * sizeof(*fds));
+		memset(fds, 0, cap * sizeof(*fds));
+		if (u->fd_cap > 0)
+			memcpy(fds, u->fds, u->fd_cap * sizeof(*fds));
+		skynet_free(u->fds);
+		u->fds = fds;
+		u->fd_cap = cap;
+	}
+	return 0;
+}
+
+static int
+sp_add(struct sp_uring *u, int sock, void *ud) {
+	if (u->ring < 0) {
+		struct epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.ptr = ud;
+		if (epoll_ctl(u->epoll, EPOLL_CTL_ADD, sock, &ev) == -1) {
+			return 1;
+		}
+		return 0;
+	}
+	if (sock < 0)
+		return 1;
+	spinlock_lock(&u->lock);
+	uring_reserve(u, sock);
+	struct sp_uring_fd *f = &u->fds[sock];
+	uring_disarm(u, sock);
+	uring_cancel_recv(u, sock, 1);
+	f->ud = ud;
+	f->events = POLLIN;
+	f->active = 1;
+	f->recv = 0;
+	f->hup = 0;
+	uring_arm(u, sock);
+	uring_flush(u);
+	spinlock_unlock(&u->lock);
+	return 0;
+}
+
+static void
+sp_del(struct sp_uring *u, int sock) {
+	if (u->ring < 0) {
+		epoll_ctl(u->epoll, EPOLL_CTL_DEL, sock , NULL);
+		return;
+	}
+	spinlock_lock(&u->lock);
+	if (sock >= 0 && sock < u->fd_cap && u->fds[sock].active) {
+		uring_disarm(u, sock);
+		uring_cancel_recv(u, sock, 1);
+		u->fds[sock].active = 0;
+		u->fds[sock].ud = NULL;
+		uring_flush(u);
+	}
+	spinlock_unlock(&u->lock);
+}
+
+static void
+sp_enable(struct sp_uring *u, int sock, void *ud, bool read_enable, bool write_enable) {
+	if (u->ring < 0) {
+		struct epoll_event ev;
+		ev.events = (read_enable ? EPOLLIN : 0) | (write_enable ? EPOLLOUT : 0);
+		ev.data.ptr = ud;
+		epoll_ctl(u->epoll, EPOLL_CTL_MOD, sock, &ev);
+		return;
+	}
+	spinlock_lock(&u->lock);
+	if (sock >= 0 && sock < u->fd_cap && u->fds[sock].active) {
+		struct sp_uring_fd *f = &u->fds[sock];
+		// POLLERR and POLLHUP are always reported, even if events is 0
+		uint32_t events = (read_enable ? POLLIN : 0) | (write_enable ? POLLOUT : 0);
+		f->ud = ud;
+		if (f->events != events) {
+			f->events = events;
+			f->hup = 0;
+			if (f->recv) {
+				if (!read_enable) {
+					uring_cancel_recv(u, sock, 0);
+				} else if (!f->recving) {
+					uring_arm_recv(u, sock);
+				}
+			}
+			if (f->armed) {
+				uring_disarm(u, sock);
+				uring_arm(u, sock);
+			} else if (f->recv && !f->queued) {
+				// the poll of recv isn't armed after POLLHUP
+				uring_arm(u, sock);
+			}
+			// else it's in the rearm list, and will be armed with the new events
+			uring_flush(u);
+		}
+	}
+	spinlock_unlock(&u->lock);
+}
+
+#ifdef SP_RECV
+
+// read the connected tcp socket by recv
+static void
+sp_recv(struct sp_uring *u, int sock) {
+	if (u->ring < 0 || u->br == NULL || u->norecv)
+		return;
+	spinlock_lock(&u->lock);
+	if (sock >= 0 && sock < u->fd_cap && u->fds[sock].active && !u->fds[sock].recv) {
+		struct sp_uring_fd *f = &u->fds[sock];
+		f->recv = 1;
+		if (f->armed) {
+			// poll without POLLIN
+			uring_disarm(u, sock);
+			uring_arm(u, sock);
+		}
+		if (f->events & POLLIN) {
+			uring_arm_recv(u, sock);
+		}
+		uring_flush(u);
+	}
+	spinlock_unlock(&u->lock);
+}
+
+#endif
+
+static int
+epoll_wait_events(int efd, struct event *e, int max) {
+	struct epoll_event ev[max];
+	int n = epoll_wait(efd , ev, max, -1);
+	int i;
+	for (i=0;i<n;i++) {
+		e[i].s = ev[i].data.ptr;
+		unsigned flag = ev[i].events;
+		e[i].write = (flag & EPOLLOUT) != 0;
+		e[i].read = (flag & (EPOLLIN | EPOLLHUP)) != 0;
+		e[i].error = (flag & EPOLLERR) != 0;
+		e[i].eof = false;
+		e[i].recv = false;
+	}
+
+	return n;
+}
+
+// call with lock, re-arm the sockets which completed last time
+static void
+uring_rearm(struct sp_uring *u) {
+	int i;
+	for (i=0;i<u->rearm_n;i++) {
+		int sock = u->rearm[i];
+		struct sp_uring_fd *f = &u->fds[sock];
+		f->queued = 0;
+		if (f->active) {
+			if (!f->armed && !f->hup) {
+				uring_arm(u, sock);
+			}
+			if (f->recv && !f->recving && (f->events & POLLIN)) {
+				uring_arm_recv(u, sock);
+			}
+		}
+	}
+	u->rearm_n = 0;
+}
+
+// call with lock, return the buffers of the last events
+static void
+uring_release_buffers(struct sp_uring *u) {
+	if (u->hold_n > 0) {
+		int i;
+		for (i=0;i<u->hold_n;i++) {
+			uring_buffer_put(u, u->hold[i]);
+		}
+		u->hold_n = 0;
+		uring_buffer_commit(u);
+	}
+}
+
+static void
+uring_queue(struct sp_uring *u, int sock) {
+	struct sp_uring_fd *f = &u->fds[sock];
+	if (!f->queued) {
+		if (u->rearm_n >= u->rearm_cap) {
+			int cap = u->rearm_cap ? u->rearm_cap * 2 : 64;
+			int * rearm = skynet_malloc(cap * sizeof(int));
+			if (u->rearm_n > 0)
+				memcpy(rearm, u->rearm, u->rearm_n * sizeof(int));
+			skynet_free(u->rearm);
+			u->rearm = rearm;
+			u->rearm_cap = cap;
+		}
+		u->rearm[u->rearm_n++] = sock;
+		f->queued = 1;
+	}
+}
+
+// call with lock, returns 1 when it's an event
+static int
+uring_reap_recv(struct sp_uring *u, struct io_uring_cqe *cqe, struct event *ev) {
+	uint64_t userdata = cqe->user_data;
+	int sock = (int)((uint32_t)userdata & ~SP_URING_RECV);
+	int bid = -1;
+	if (cqe->flags & IORING_CQE_F_BUFFER) {
+		bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+	}
+	struct sp_uring_fd *f = sock < u->fd_cap ? &u->fds[sock] : NULL;
+	if (f == NULL || !f->active || (uint32_t)(userdata >> 32) != f->rgen) {
+		if (bid >= 0) {
+			uring_buffer_put(u, bid);
+			uring_buffer_commit(u);
+		}
+		return 0;
+	}
+	int res = cqe->res;
+	if (!(cqe->flags & IORING_CQE_F_MORE)) {
+		f->recving = 0;
+		if (res > 0 || res == -ENOBUFS || res == -ECANCELED) {
+			// no more buffers now (or canceled by sp_enable), recv again if it's still reading
+			uring_queue(u, sock);
+		} else if (res == -EINVAL) {
+			// multishot recv isn't supported (linux < 6.0), use poll and read
+			f->recv = 0;
+			u->norecv = 1;
+			if (f->armed) {
+				uring_disarm(u, sock);
+			}
+			uring_queue(u, sock);
+			return 0;
+		}
+	}
+	if (res == -ENOBUFS || res == -ECANCELED) {
+		return 0;
+	}
+	ev->s = f->ud;
+	ev->read = true;
+	ev->write = false;
+	ev->error = false;
+	ev->eof = false;
+	ev->recv = true;
+	ev->size = res;
+	ev->data = NULL;
+	if (bid >= 0) {
+		ev->data = u->buffer + bid * SP_URING_BUFFER_SIZE;
+		u->hold[u->hold_n++] = bid;
+	}
+	return 1;
+}
+
+// call with lock
+static int
+uring_reap(struct sp_uring *u, struct event *e, int max) {
+	unsigned head = *u->cq_head;
+	unsigned tail = uring_load(u->cq_tail);
+	unsigned mask = *u->cq_mask;
+	int n = 0;
+	while (head != tail && n < max) {
+		struct io_uring_cqe *cqe = &u->cqes[head & mask];
+		++head;
+		uint64_t userdata = cqe->user_data;
+		if (userdata == SP_URING_IGNORE)
+			continue;
+		if (userdata & SP_URING_RECV) {
+			n += uring_reap_recv(u, cqe, &e[n]);
+			continue;
+		}
+		int sock = (int)(uint32_t)userdata;
+		if (sock >= u->fd_cap)
+			continue;
+		struct sp_uring_fd *f = &u->fds[sock];
+		if (!f->active || (uint32_t)(userdata >> 32) != f->gen)
+			continue;
+		f->armed = 0;
+		uring_queue(u, sock);
+		int res = cqe->res;
+		if (res == -ECANCELED)
+			continue;
+		struct event *ev = &e[n];
+		ev->s = f->ud;
+		ev->recv = false;
+		if (res < 0) {
+			ev->read = false;
+			ev->write = false;
+			ev->error = true;
+		} else {
+			ev->write = (res & POLLOUT) != 0;
+			ev->read = (res & (POLLIN | POLLHUP)) != 0;
+			ev->error = (res & POLLERR) != 0;
+			if (f->recv) {
+				// recv reads the data and the eof
+				ev->read = false;
+				if (!ev->write && !ev->error) {
+					// POLLHUP only, don't poll it again until sp_enable
+					f->hup = 1;
+					continue;
+				}
+			}
+		}
+		ev->eof = false;
+		++n;
+	}
+	__sync_synchronize();
+	*u->cq_head = head;
+	return n;
+}
+
+static int
+sp_wait(struct sp_uring *u, struct event *e, int max) {
+	if (u->ring < 0) {
+		return epoll_wait_events(u->epoll, e, max);
+	}
+	if (!u->has_owner) {
+		u->owner = pthread_self();
+		u->has_owner = 1;
+	}
+	for (;;) {
+		spinlock_lock(&u->lock);
+		// the events of last time are handled now
+		uring_release_buffers(u);
+		uring_rearm(u);
+		int n = uring_reap(u, e, max);
+		if (n == 0) {
+			// the completions without events (ENOBUFS of recv, ...) may be re-armed now, before waiting.
+			uring_rearm(u);
+		}
+		unsigned submit = uring_pending(u);
+		spinlock_unlock(&u->lock);
+		if (n > 0) {
+			return n;
+		}
+		// submit and wait in one syscall
+		if (uring_enter(u->ring, submit, 1, IORING_ENTER_GETEVENTS) < 0) {
+			if (errno != EAGAIN && errno != EBUSY) {
+				// socket_server_poll retries when EINTR
+				return -1;
+			}
+		}
+	}
+}
+
+static void
+sp_nonblocking(int fd) {
+	int flag = fcntl(fd, F_GETFL, 0);
+	if ( -1 == flag ) {
+		return;
+	}
+
+	fcntl(fd, F_SETFL, flag | O_NONBLOCK);
+}
+
+#endif
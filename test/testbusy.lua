@@ -0,0 +1,60 @@
+local skynet = require "skynet"
+require "skynet.manager"	-- import skynet.kill
+
+-- A service sends to another one and then spins inside its handler. The receiver is in the local run queue
+-- of the busy worker, it should be stolen by another worker (woken up if it's parked) and run before the spin ends.
+-- Run it with worker_idle = "park" / "hybrid" / "spin" in config (thread >= 2).
+
+local SPIN = 1	-- sec
+
+local mode = ...
+
+if mode == "busy" then
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_,_, receiver)
+		local t = skynet.hpc()
+		skynet.send(receiver, "lua", "ping", t)
+		while skynet.hpc() - t < SPIN * 1e9 do end
+		skynet.send(receiver, "lua", "done")
+	end)
+end)
+
+elseif mode == "receiver" then
+
+local ping
+local done = false
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_,_, cmd, t)
+		if cmd == "ping" then
+			if not done then
+				ping = skynet.hpc() - t
+			end
+		elseif cmd == "done" then
+			done = true
+		else
+			skynet.ret(skynet.pack(ping, done))
+		end
+	end)
+end)
+
+else
+
+skynet.start(function()
+	local receiver = skynet.newservice(SERVICE_NAME, "receiver")
+	local busy = skynet.newservice(SERVICE_NAME, "busy")
+	skynet.sleep(10)	-- let the workers park
+	skynet.send(busy, "lua", receiver)
+	skynet.sleep(SPIN * 100 + 50)
+	local ping, done = skynet.call(receiver, "lua", "result")
+	assert(done, "busy service doesn't finish")
+	assert(ping and ping < SPIN * 1e9 / 2, "the receiver waits until the busy handler returns")
+	print(string.format("worker_idle = %s, the receiver runs %.1fms after the send, while the sender spins",
+		skynet.getenv "worker_idle", ping / 1e6))
+	skynet.kill(receiver)
+	skynet.kill(busy)
+	print("ok")
+end)
+
+end
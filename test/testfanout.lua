@@ -0,0 +1,85 @@
+local skynet = require "skynet"
+local memory = require "skynet.memory"
+require "skynet.manager"	-- import skynet.kill
+
+-- Broadcast a large message to many services, by skynet.send (packed and copied for each one)
+-- and by skynet.fanout (packed once, shared by the receivers). The receivers check the content.
+
+local RECEIVER = 16
+local COUNT = 500
+local PAYLOAD = string.rep("x", 64 * 1024)
+
+local mode = ...
+
+if mode == "receiver" then
+
+local n = 0
+local bad = 0
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_, _, cmd, i, payload)
+		if cmd == "data" then
+			n = n + 1
+			if payload ~= PAYLOAD then
+				bad = bad + 1
+			end
+		else
+			skynet.ret(skynet.pack(n, bad))
+			n = 0
+			bad = 0
+		end
+	end)
+end)
+
+else
+
+local function wait(receivers)
+	local total, bad = 0, 0
+	for _, addr in ipairs(receivers) do
+		local n, b = skynet.call(addr, "lua", "count")
+		total = total + n
+		bad = bad + b
+	end
+	return total, bad
+end
+
+skynet.start(function()
+	local receivers = {}
+	for i=1,RECEIVER do
+		receivers[i] = skynet.newservice(SERVICE_NAME, "receiver")
+	end
+
+	local t = skynet.now()
+	for i=1,COUNT do
+		for _, addr in ipairs(receivers) do
+			skynet.send(addr, "lua", "data", i, PAYLOAD)
+		end
+	end
+	local n, bad = wait(receivers)
+	print(string.format("send : %d messages (bad %d) in %.2fs", n, bad, (skynet.now() - t) / 100))
+	local block = memory.block()
+
+	t = skynet.now()
+	for i=1,COUNT do
+		skynet.fanout(receivers, "lua", "data", i, PAYLOAD)
+	end
+	n, bad = wait(receivers)
+	print(string.format("fanout : %d messages (bad %d) in %.2fs", n, bad, (skynet.now() - t) / 100))
+
+	-- the dead receiver releases its reference too
+	skynet.kill(receivers[RECEIVER])
+	print("fanout failures", skynet.fanout(receivers, "lua", "data", 0, PAYLOAD))
+	-- local names are resolved like skynet.send, and the message is freed when an address is invalid.
+	skynet.name(".fanout_receiver", receivers[1])
+	print("fanout by name failures", skynet.fanout({ ".fanout_receiver", ".nobody" }, "lua", "data", 0, PAYLOAD))
+	print("fanout to invalid address", pcall(skynet.fanout, { receivers[1], {} }, "lua", "data", 0, PAYLOAD))
+	skynet.sleep(10)
+	-- the shared messages should all be freed by now
+	print("memory block", block, memory.block())
+
+	for i=1,RECEIVER-1 do
+		skynet.kill(receivers[i])
+	end
+end)
+
+end
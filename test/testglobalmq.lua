@@ -0,0 +1,76 @@
+local skynet = require "skynet"
+
+-- Fan-out benchmark for the global message queue.
+-- Run it with thread = 4/16/32 in config, and build with/without -DUSE_GLOBALMQ_SPINLOCK to compare.
+
+local mode, arg = ...
+
+if mode == "sink" then
+
+skynet.start(function()
+	local count = 0
+	skynet.dispatch("lua", function(_,_, cmd)
+		if cmd == "ping" then
+			count = count + 1
+		else
+			skynet.ret(skynet.pack(count))
+			count = 0
+		end
+	end)
+end)
+
+elseif mode == "source" then
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_,_, sinks, n)
+		for i = 1, n do
+			for _, sink in ipairs(sinks) do
+				skynet.send(sink, "lua", "ping")
+			end
+			if i % 100 == 0 then
+				skynet.yield()
+			end
+		end
+		skynet.ret()
+	end)
+end)
+
+else
+
+local SINK = 64
+local SOURCE = 8
+local ROUND = 2000
+
+skynet.start(function()
+	local sinks = {}
+	for i = 1, SINK do
+		sinks[i] = skynet.newservice(SERVICE_NAME, "sink")
+	end
+	local sources = {}
+	for i = 1, SOURCE do
+		sources[i] = skynet.newservice(SERVICE_NAME, "source")
+	end
+	local thread = skynet.getenv "thread"
+	local begin = skynet.hpc()
+	local co = coroutine.running()
+	local n = SOURCE
+	for _, source in ipairs(sources) do
+		skynet.fork(function()
+			skynet.call(source, "lua", sinks, ROUND)
+			n = n - 1
+			if n == 0 then
+				skynet.wakeup(co)
+			end
+		end)
+	end
+	skynet.wait(co)
+	local total = 0
+	for _, sink in ipairs(sinks) do
+		total = total + skynet.call(sink, "lua", "count")
+	end
+	local ti = (skynet.hpc() - begin) / 1000000000
+	skynet.error(string.format("thread = %s, %d messages in %.3f sec, %.0f msg/s", thread, total, ti, total / ti))
+	skynet.exit()
+end)
+
+end
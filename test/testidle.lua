@@ -0,0 +1,48 @@
+local skynet = require "skynet"
+
+-- Latency and idle cpu benchmark for worker idle modes.
+-- Run it with worker_idle = "spin" / "park" / "hybrid" in config.
+-- The ping messages are sent one by one with a gap, so the workers are idle most of the time.
+
+local mode = ...
+
+if mode == "echo" then
+
+skynet.start(function()
+	skynet.dispatch("lua", function()
+		skynet.ret()
+	end)
+end)
+
+else
+
+local ROUND = 1000
+
+local function idle_cpu(ti)
+	local c = os.clock()	-- cpu time of the whole process
+	skynet.sleep(ti)
+	return (os.clock() - c) / (ti / 100)
+end
+
+skynet.start(function()
+	local echo = skynet.newservice(SERVICE_NAME, "echo")
+	local lat = {}
+	for i = 1, ROUND do
+		local t = skynet.hpc()
+		skynet.call(echo, "lua")
+		lat[i] = skynet.hpc() - t
+		if i % 10 == 0 then
+			skynet.sleep(1)
+		end
+	end
+	table.sort(lat)
+	local function us(p)
+		return lat[math.ceil(#lat * p)] / 1000
+	end
+	local cpu = idle_cpu(300)
+	skynet.error(string.format("worker_idle = %s, thread = %s, latency p50 = %.1fus p99 = %.1fus max = %.1fus, idle cpu = %.1f%%",
+		skynet.getenv "worker_idle", skynet.getenv "thread", us(0.5), us(0.99), us(1), cpu * 100))
+	skynet.exit()
+end)
+
+end
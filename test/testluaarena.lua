@@ -0,0 +1,59 @@
+local skynet = require "skynet"
+local memory = require "skynet.memory"
+require "skynet.manager"	-- import skynet.kill
+
+-- Lua allocation benchmark : many services build and drop tables at the same time.
+-- Run it with and without lua_arena = "service" (or a number of shared arenas) in config, and compare.
+-- With lua_arena, memory.info() returns the resident memory of the arena of each service as the second table.
+
+local SERVICE = 8
+local COUNT = 100000
+
+local mode = ...
+
+if mode == "worker" then
+
+skynet.start(function()
+	skynet.dispatch("lua", function()
+		local keep = {}
+		for i=1,COUNT do
+			local t = { i, tostring(i), { x = i } }
+			keep[i % 1000 + 1] = t
+		end
+		skynet.ret()
+	end)
+end)
+
+else
+
+skynet.start(function()
+	print("lua_arena", skynet.getenv "lua_arena")
+	local workers = {}
+	for i=1,SERVICE do
+		workers[i] = skynet.newservice(SERVICE_NAME, "worker")
+	end
+	local t = skynet.now()
+	local done = 0
+	for i=1,SERVICE do
+		skynet.fork(function()
+			skynet.call(workers[i], "lua")
+			done = done + 1
+		end)
+	end
+	while done < SERVICE do
+		skynet.sleep(1)
+	end
+	t = (skynet.now() - t) / 100
+	print(string.format("%d services : %d loops in %.2fs, %d/s", SERVICE, SERVICE * COUNT, t, math.floor(SERVICE * COUNT / t)))
+	local _, resident = memory.info()
+	if resident then
+		for i=1,SERVICE do
+			print(string.format("worker :%08x arena resident %d K", workers[i], (resident[workers[i]] or 0) // 1024))
+		end
+	end
+	for i=1,SERVICE do
+		skynet.kill(workers[i])
+	end
+end)
+
+end
@@ -0,0 +1,64 @@
+local skynet = require "skynet"
+local memory = require "skynet.memory"
+require "skynet.manager"	-- import skynet.kill
+
+-- Many services pack (skynet_malloc) and trash (skynet_free) messages at the same time.
+-- It's the benchmark of the memory accounting in malloc_hook.c, run with thread = 8 (or more) in config.
+-- The counters should come back after the test.
+
+local SERVICE = 8
+local COUNT = 200000
+
+local mode = ...
+
+if mode == "worker" then
+
+skynet.start(function()
+	skynet.dispatch("lua", function()
+		local data = { 1, 2, 3, "hello", { x = 1 } }
+		for i=1,COUNT do
+			local msg, sz = skynet.pack(data)
+			skynet.trash(msg, sz)
+		end
+		skynet.ret()
+	end)
+end)
+
+else
+
+local function service_total()
+	local total = 0
+	for _, v in pairs(memory.info()) do
+		total = total + v
+	end
+	return total
+end
+
+skynet.start(function()
+	local workers = {}
+	for i=1,SERVICE do
+		workers[i] = skynet.newservice(SERVICE_NAME, "worker")
+	end
+	local total, block, service = memory.total(), memory.block(), service_total()
+	local t = skynet.now()
+	local done = 0
+	for i=1,SERVICE do
+		skynet.fork(function()
+			skynet.call(workers[i], "lua")
+			done = done + 1
+		end)
+	end
+	while done < SERVICE do
+		skynet.sleep(1)
+	end
+	t = (skynet.now() - t) / 100
+	print(string.format("%d services : %d pack/trash in %.2fs, %d/s", SERVICE, SERVICE * COUNT, t, math.floor(SERVICE * COUNT / t)))
+	print("memory total", total, memory.total())
+	print("memory block", block, memory.block())
+	print("service total", service, service_total())
+	for i=1,SERVICE do
+		skynet.kill(workers[i])
+	end
+end)
+
+end
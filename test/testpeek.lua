@@ -0,0 +1,141 @@
+local skynet = require "skynet"
+require "skynet.manager"	-- import skynet.forward_type, skynet.kill
+
+-- skynet.peek and skynet.unpack_lazy, and a router which reads the command only and forwards the message.
+
+local COUNT = 20000
+
+local mode = ...
+
+if mode == "router" then
+
+local target = {}
+
+skynet.register_protocol {
+	name = "system",
+	id = skynet.PTYPE_SYSTEM,
+	unpack = function (...) return ... end,
+}
+
+skynet.forward_type( { [skynet.PTYPE_LUA] = skynet.PTYPE_SYSTEM }, function()
+	skynet.dispatch("system", function (session, source, msg, sz)
+		local cmd = skynet.peek(msg, sz, 1)
+		if cmd == "register" then
+			local name, addr = select(2, skynet.unpack(msg, sz))
+			target[name] = addr
+			skynet.trash(msg, sz)
+			skynet.ret()
+		else
+			-- the message isn't copied, nor packed again
+			skynet.redirect(target[cmd], source, "lua", session, msg, sz)
+			skynet.ignoreret()	-- target responds
+		end
+	end)
+end)
+
+elseif mode == "echo" then
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_, _, cmd, t)
+		skynet.ret(skynet.pack(#t.records, t.records[#t.records].name))
+	end)
+end)
+
+else
+
+local function equal(a, b)
+	if type(a) ~= "table" or type(b) ~= "table" then
+		return a == b
+	end
+	for k,v in pairs(a) do
+		if not equal(v, b[k]) then
+			return false
+		end
+	end
+	for k in pairs(b) do
+		if a[k] == nil then
+			return false
+		end
+	end
+	return true
+end
+
+local function test(pack)
+	local records = {}
+	for i=1,100 do
+		records[i] = { id = i, name = "item" .. i, [true] = i, [i+0.5] = i }
+	end
+	local args = { "echo", { records = records, n = 100, deep = { { { "x" } } } }, 3.5, false, nil, "end" }
+	local msg, sz = pack(table.unpack(args, 1, 6))
+
+	assert(select("#", skynet.peek(msg, sz, 1)) == 1)
+	assert(skynet.peek(msg, sz, 1) == "echo")
+	assert(equal({ skynet.peek(msg, sz, 3) }, { table.unpack(args, 1, 3) }))
+	assert(select("#", skynet.peek(msg, sz, 10)) == 6)
+
+	local lazy = skynet.unpack_lazy(msg, sz)
+	skynet.trash(msg, sz)	-- lazy has a copy
+	assert(#lazy == 6)
+	assert(lazy[1] == "echo" and lazy[3] == 3.5 and lazy[4] == false and lazy[5] == nil and lazy[6] == "end")
+	assert(lazy[7] == nil and lazy.x == nil)
+	local t = lazy[2]
+	assert(type(t) == "userdata" and t.n == 100 and t.x == nil)
+	assert(#t.records == 100 and t.records[50].name == "item50" and t.records[50][true] == 50 and t.records[50][50.5] == 50)
+	assert(t.deep[1][1][1] == "x")
+	local all = {}
+	for k, v in pairs(lazy) do
+		all[k] = v
+	end
+	assert(equal(all, args))
+	local r = {}
+	for k, v in pairs(t.records[3]) do
+		r[k] = v
+	end
+	assert(equal(r, records[3]))
+	assert(#skynet.unpack_lazy(skynet.packstring()) == 0)
+	assert(not pcall(skynet.unpack_lazy, "\x06\x02"))
+end
+
+local function bench(pack, records)
+	local msg, sz = pack("echo", { records = records })
+	local t = skynet.hpc()
+	for i=1,COUNT do
+		skynet.unpack(msg, sz)
+	end
+	local tunpack = (skynet.hpc() - t) / 1e9
+	t = skynet.hpc()
+	for i=1,COUNT do
+		skynet.peek(msg, sz, 1)
+	end
+	local tpeek = (skynet.hpc() - t) / 1e9
+	t = skynet.hpc()
+	for i=1,COUNT do
+		local lazy = skynet.unpack_lazy(msg, sz)
+		local _ = lazy[2].records[1].name
+	end
+	local tlazy = (skynet.hpc() - t) / 1e9
+	skynet.trash(msg, sz)
+	print(string.format("%-8s size %5d : unpack %.3fs, peek 1 %.3fs, unpack_lazy and read a field %.3fs", pack == skynet.pack and "pack" or "packdict", sz, tunpack, tpeek, tlazy))
+end
+
+skynet.start(function()
+	test(skynet.pack)
+	test(skynet.packdict)
+	local records = {}
+	for i=1,100 do
+		records[i] = { id = i, name = "item" .. i, count = i * 3 }
+	end
+	bench(skynet.pack, records)
+	bench(skynet.packdict, records)
+
+	local router = skynet.newservice(SERVICE_NAME, "router")
+	local echo = skynet.newservice(SERVICE_NAME, "echo")
+	skynet.call(router, "lua", "register", "echo", echo)
+	local n, name = skynet.call(router, "lua", "echo", { records = records })
+	assert(n == 100 and name == "item100")
+	skynet.kill(router)
+	skynet.kill(echo)
+	print("ok")
+end)
+
+end
@@ -0,0 +1,73 @@
+local skynet = require "skynet"
+
+-- Ping-pong throughput benchmark for the service message queue.
+-- Each pair of services sends messages back and forth, so every message is a push and a pop of one mq.
+-- Set worker_cpu / numa in config to compare worker placement.
+
+local mode = ...
+
+if mode == "pong" then
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_, source, n)
+		skynet.send(source, "lua", n)
+	end)
+end)
+
+elseif mode == "ping" then
+
+skynet.start(function()
+	local pong = skynet.newservice(SERVICE_NAME, "pong")
+	local response
+	local count
+	skynet.dispatch("lua", function(_, _, n, burst)
+		if response == nil then
+			-- start
+			response = skynet.response()
+			count = n
+			for i = 1, burst do
+				skynet.send(pong, "lua", i)
+			end
+			return
+		end
+		count = count - 1
+		if count > 0 then
+			skynet.send(pong, "lua", count)
+		elseif count == 0 then
+			response(true)
+		end
+	end)
+end)
+
+else
+
+local PAIR = 8
+local ROUND = 100000
+local BURST = 16	-- messages in flight per pair
+
+skynet.start(function()
+	local pings = {}
+	for i = 1, PAIR do
+		pings[i] = skynet.newservice(SERVICE_NAME, "ping")
+	end
+	local begin = skynet.hpc()
+	local co = coroutine.running()
+	local n = PAIR
+	for _, ping in ipairs(pings) do
+		skynet.fork(function()
+			skynet.call(ping, "lua", ROUND, BURST)
+			n = n - 1
+			if n == 0 then
+				skynet.wakeup(co)
+			end
+		end)
+	end
+	skynet.wait(co)
+	local ti = (skynet.hpc() - begin) / 1000000000
+	local total = PAIR * ROUND * 2
+	skynet.error(string.format("thread = %s, worker_cpu = %s, numa = %s, %d messages in %.3f sec, %.0f msg/s",
+		skynet.getenv "thread", skynet.getenv "worker_cpu", skynet.getenv "numa", total, ti, total / ti))
+	skynet.exit()
+end)
+
+end
@@ -0,0 +1,71 @@
+local skynet = require "skynet"
+require "skynet.manager"	-- import skynet.kill
+
+-- Latency of an interactive service while batch services saturate all the workers.
+
+local mode, class, budget = ...
+
+if mode == "echo" then
+
+skynet.start(function()
+	skynet.priority(class)
+	skynet.dispatch("lua", function()
+		skynet.ret()
+	end)
+end)
+
+elseif mode == "batch" then
+
+skynet.start(function()
+	skynet.priority(class, budget)	-- a string from the arguments
+	local self = skynet.self()
+	skynet.dispatch("lua", function(_,_, n)
+		local s = 0
+		for i = 1, 10000 do
+			s = s + i
+		end
+		if n > 0 then
+			skynet.send(self, "lua", n - 1)
+		end
+	end)
+	for i = 1, 16 do
+		skynet.send(self, "lua", 200000)
+	end
+end)
+
+else
+
+local BATCH = 8
+local ROUND = 200
+
+local function test(echo_class, batch_class, batch_budget)
+	local batch = {}
+	for i = 1, BATCH do
+		batch[i] = skynet.newservice(SERVICE_NAME, "batch", batch_class, batch_budget or 0)
+	end
+	local echo = skynet.newservice(SERVICE_NAME, "echo", echo_class)
+	local lat = {}
+	for i = 1, ROUND do
+		local t = skynet.hpc()
+		skynet.call(echo, "lua")
+		lat[i] = skynet.hpc() - t
+		skynet.sleep(1)
+	end
+	for _, s in ipairs(batch) do
+		skynet.kill(s)
+	end
+	skynet.kill(echo)
+	table.sort(lat)
+	skynet.error(string.format("echo = %s, batch = %s budget %s, latency p50 = %.1fus p99 = %.1fus",
+		echo_class, batch_class, batch_budget or 0, lat[ROUND//2] / 1000, lat[math.ceil(ROUND * 0.99)] / 1000))
+end
+
+skynet.start(function()
+	skynet.priority "high"	-- the caller itself should not wait behind batch services
+	test("normal", "normal")
+	test("high", "low")
+	test("high", "low", 2e4)
+	skynet.exit()
+end)
+
+end
@@ -0,0 +1,47 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+
+-- The file is sent by sendfile, and the large buffer by MSG_ZEROCOPY (it turns off by itself on loopback,
+-- after the first completion). Check the stream is in order, and the socket closes after all sent.
+
+local PORT = 8004
+local SIZE = 4 * 1024 * 1024
+
+skynet.start(function()
+	local filename = os.tmpname()
+	local f = assert(io.open(filename, "wb"))
+	local content = {}
+	for i=1,SIZE/16 do
+		content[i] = string.format("%015d\n", i)
+	end
+	content = table.concat(content)
+	f:write(content)
+	f:close()
+	local big = string.rep("z", 1024 * 1024)
+
+	local lid = socket.listen("127.0.0.1", PORT)
+	socket.start(lid, function(id, addr)
+		socket.start(id)
+		socket.zerocopy(id)
+		socket.write(id, big)
+		assert(socket.sendfile(id, filename))
+		socket.write(id, "middle")
+		assert(socket.sendfile(id, filename, 1000, 100))
+		assert(not socket.sendfile(id, filename .. ".notexist"))
+		socket.write(id, big)
+		socket.close(id)
+	end)
+
+	local id = assert(socket.open("127.0.0.1", PORT))
+	local t = skynet.now()
+	assert(socket.read(id, #big) == big)
+	assert(socket.read(id, SIZE) == content)
+	assert(socket.read(id, 6) == "middle")
+	assert(socket.read(id, 100) == content:sub(1001, 1100))
+	assert(socket.read(id, #big) == big)
+	assert(socket.read(id) == false)
+	print("sendfile ok", (skynet.now() - t) / 100, "s")
+	socket.close(id)
+	socket.close(lid)
+	os.remove(filename)
+end)
@@ -0,0 +1,99 @@
+local skynet = require "skynet"
+
+-- Benchmark of skynet.pack / skynet.unpack with some typical payloads,
+-- and skynet.packdict (the table shapes are packed once per message) for comparison.
+
+local COUNT = 20000
+
+local payload = {}
+
+payload.rpc = { "query", 12345, "player", { id = 100001, name = "hello", level = 30 }, true }
+
+local records = {}
+for i=1,100 do
+	records[i] = { id = i, name = "item" .. i, count = i * 3, price = i * 1.5, bind = i % 2 == 0 }
+end
+payload.records = { records }
+
+local function config(depth)
+	if depth == 0 then
+		return { enable = true, value = depth, name = "leaf" }
+	end
+	local t = { size = depth, timeout = 30, tag = "node" .. depth }
+	for i=1,3 do
+		t["child" .. i] = config(depth-1)
+	end
+	return t
+end
+payload.config = { config(5) }
+
+local function equal(a, b)
+	if type(a) ~= "table" or type(b) ~= "table" then
+		return a == b
+	end
+	for k,v in pairs(a) do
+		if not equal(v, b[k]) then
+			return false
+		end
+	end
+	for k in pairs(b) do
+		if a[k] == nil then
+			return false
+		end
+	end
+	return true
+end
+
+local function bench(name, pack, args)
+	local msg, sz = pack(table.unpack(args))
+	assert(equal(args, { skynet.unpack(msg, sz) }), name)
+	skynet.trash(msg, sz)
+	local t = skynet.hpc()
+	for i=1,COUNT do
+		msg, sz = pack(table.unpack(args))
+		skynet.trash(msg, sz)
+	end
+	local tpack = (skynet.hpc() - t) / 1e9
+	msg, sz = pack(table.unpack(args))
+	t = skynet.hpc()
+	for i=1,COUNT do
+		skynet.unpack(msg, sz)
+	end
+	local tunpack = (skynet.hpc() - t) / 1e9
+	skynet.trash(msg, sz)
+	print(string.format("%-8s %-9s size %6d pack %.3fs unpack %.3fs", name, pack == skynet.pack and "pack" or "packdict", sz, tpack, tunpack))
+end
+
+skynet.start(function()
+	for _, name in ipairs { "rpc", "records", "config" } do
+		bench(name, skynet.pack, payload[name])
+		if skynet.packdict then
+			bench(name, skynet.packdict, payload[name])
+		end
+	end
+	-- shapes with array part, the same keys in different order, and many keys
+	local mixed = { { 1, 2, a = 1, b = 2 }, { b = 2, a = 1 }, { a = { a = 1, b = { 3 } } }, { [100] = 1, a = 1 } }
+	local many = {}
+	for i=1,100 do
+		many["key" .. i] = i
+	end
+	mixed[5] = many
+	for i=1,100 do
+		mixed[#mixed+1] = { ["x" .. i] = i }
+	end
+	assert(equal({ mixed, mixed }, { skynet.unpack(skynet.packdict(mixed, mixed)) }))
+	-- nested pack in __pairs
+	local t = setmetatable({}, { __pairs = function(t)
+		local packed = skynet.packstring(records)
+		return next, { packed = packed }
+	end })
+	local _, s = skynet.unpack(skynet.packstring(1, t))
+	assert(equal({ skynet.unpack(s.packed) }, { records }))
+	-- errors
+	assert(not pcall(skynet.pack, { f = print }))
+	assert(not pcall(skynet.pack, records, print))
+	local deep = {}
+	for i=1,40 do deep = { deep } end
+	assert(not pcall(skynet.pack, deep))
+	print("ok")
+end)
@@ -0,0 +1,73 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+
+-- Benchmark of the poll mode : build with and without -DUSE_EPOLLET and compare.
+-- 1. bulk receive : 64M from one connection.
+-- 2. connection storm : many connections at once, the listen socket accepts them.
+
+local PORT = 8007
+local CHUNK = 64 * 1024
+local COUNT = 1024	-- 64M
+local STORM = 400
+
+local function bulk()
+	local server
+	local lid = socket.listen("127.0.0.1", PORT)
+	socket.start(lid, function(id)
+		socket.start(id)
+		server = id
+	end)
+	local id = assert(socket.open("127.0.0.1", PORT))
+	while not server do
+		skynet.sleep(1)
+	end
+	local chunk = string.rep("x", CHUNK)
+	local t = skynet.now()
+	skynet.fork(function()
+		for i=1,COUNT do
+			socket.write(id, chunk)
+			if i % 16 == 0 then
+				skynet.yield()
+			end
+		end
+	end)
+	local n = 0
+	while n < CHUNK * COUNT do
+		local data = assert(socket.read(server))
+		n = n + #data
+	end
+	t = (skynet.now() - t) / 100
+	print(string.format("bulk : %d MB in %.2fs, %.1f MB/s", n // (1024*1024), t, n / (1024*1024) / t))
+	socket.close(id)
+	socket.close(server)
+	socket.close(lid)
+end
+
+local function storm()
+	local accepted = 0
+	local lid = socket.listen("127.0.0.1", PORT + 1, STORM)
+	socket.start(lid, function(id)
+		accepted = accepted + 1
+		socket.close(id)
+	end)
+	local t = skynet.now()
+	for i=1,STORM do
+		skynet.fork(function()
+			local id = socket.open("127.0.0.1", PORT + 1)
+			if id then
+				socket.close(id)
+			end
+		end)
+	end
+	while accepted < STORM do
+		skynet.sleep(1)
+	end
+	t = (skynet.now() - t) / 100
+	print(string.format("storm : %d connections accepted in %.2fs, %d/s", accepted, t, math.floor(accepted / t)))
+	socket.close(lid)
+end
+
+skynet.start(function()
+	bulk()
+	storm()
+end)
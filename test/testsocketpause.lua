@@ -0,0 +1,51 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+
+-- The accepted socket is paused, so the writer is blocked by the tcp flow control (its write buffer grows),
+-- and nothing is lost after resume.
+
+local PORT = 8005
+local CHUNK = 64 * 1024
+local COUNT = 256	-- 16M
+
+local function stat(id)
+	for _, v in ipairs(socket.netstat()) do
+		if v.id == id then
+			return v
+		end
+	end
+end
+
+skynet.start(function()
+	local server
+	local lid = socket.listen("127.0.0.1", PORT)
+	socket.start(lid, function(id, addr)
+		socket.start(id)
+		socket.pause(id)
+		server = id
+	end)
+
+	local id = assert(socket.open("127.0.0.1", PORT))
+	while not server do
+		skynet.sleep(1)
+	end
+	local chunk = {}
+	for i=1,COUNT do
+		chunk[i] = string.rep(string.char(i % 256), CHUNK)
+		socket.write(id, chunk[i])
+	end
+	skynet.sleep(100)
+	local r = stat(server)
+	local w = stat(id)
+	print(string.format("paused : read %d, write %d, write buffer %d", r.read, w.write, w.wbuffer))
+	assert(w.wbuffer > 0)
+
+	socket.resume(server)
+	for i=1,COUNT do
+		assert(socket.read(server, CHUNK) == chunk[i])
+	end
+	print("resumed : all received")
+	socket.close(id)
+	socket.close(server)
+	socket.close(lid)
+end)
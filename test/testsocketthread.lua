@@ -0,0 +1,60 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+
+-- run with socket_thread = 4 (or more) in config, the connections are sharded across the socket threads.
+-- It's also the echo benchmark of the poll backends : build with and without -DUSE_IO_URING and compare.
+
+local PORT = 8002
+local CLIENT = 64
+local ROUND = 1000
+
+local function echo(id)
+	socket.start(id)
+	while true do
+		local str = socket.readline(id)
+		if str then
+			socket.write(id, str .. "\n")
+		else
+			socket.close(id)
+			return
+		end
+	end
+end
+
+local function client(shard, n)
+	local id = assert(socket.open("127.0.0.1", PORT))
+	for i=1,ROUND do
+		socket.write(id, i .. "\n")
+		assert(socket.readline(id) == tostring(i))
+	end
+	socket.close(id)
+	local s = (id >> 16) % n
+	shard[s] = (shard[s] or 0) + 1
+end
+
+skynet.start(function()
+	local n = tonumber(skynet.getenv "socket_thread")
+	local lid = socket.listen("127.0.0.1", PORT)
+	socket.start(lid, function(id, addr)
+		skynet.fork(echo, id)
+	end)
+
+	local shard = {}
+	local done = 0
+	local t = skynet.now()
+	for i=1,CLIENT do
+		skynet.fork(function()
+			client(shard, n)
+			done = done + 1
+		end)
+	end
+	while done < CLIENT do
+		skynet.sleep(10)
+	end
+	t = (skynet.now() - t) / 100
+	print(string.format("socket_thread %d : %d echos in %.2fs, %d/s", n, CLIENT * ROUND, t, math.floor(CLIENT * ROUND / t)))
+	for i=0,n-1 do
+		print("shard", i, shard[i] or 0)
+	end
+	socket.close(lid)
+end)
@@ -0,0 +1,35 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+
+-- Many small packets are queued to one socket while the peer doesn't read,
+-- they are flushed by writev later (with partial writes). Check nothing is lost or reordered.
+
+local PORT = 8003
+local COUNT = 200000
+
+skynet.start(function()
+	local lid = socket.listen("127.0.0.1", PORT)
+	socket.start(lid, function(id, addr)
+		socket.start(id)
+		local t = skynet.now()
+		for i=1,COUNT do
+			socket.write(id, i .. "\n")
+		end
+		print("queued", COUNT, "packets in", (skynet.now() - t) / 100, "s")
+	end)
+
+	local id = assert(socket.open("127.0.0.1", PORT))
+	-- let the kernel buffer be full
+	skynet.sleep(50)
+	local t = skynet.now()
+	for i=1,COUNT do
+		local line = socket.readline(id)
+		if line ~= tostring(i) then
+			print("ERROR", i, line)
+			return
+		end
+	end
+	print("received", COUNT, "packets in", (skynet.now() - t) / 100, "s")
+	socket.close(id)
+	socket.close(lid)
+end)
@@ -13,6 +13,8 @@ end
 
 local function test()
 	skynet.timeout(10, function() print("test timeout 10") end)
+	local _, session = skynet.timeout(5, function() error("cancelled timeout fired") end)
+	print("cancel timeout", skynet.canceltimeout(session))
 	for i=1,10 do
 		print("test sleep",i,skynet.now())
 		skynet.sleep(1)
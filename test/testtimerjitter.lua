@@ -0,0 +1,40 @@
+local skynet = require "skynet"
+
+-- Jitter of skynet.sleep_ms, run with timer_tick = 10 (default) / 5 / 1 in config to compare.
+
+local mode = ...
+
+local ROUND = 500
+local INTERVAL = 5	-- ms
+
+if mode == "slave" then
+
+skynet.start(function()
+	skynet.dispatch("lua", function()
+		local err = {}
+		for i = 1, ROUND do
+			local t = skynet.hpc()
+			skynet.sleep_ms(INTERVAL)
+			-- error in microsecond
+			err[i] = math.abs((skynet.hpc() - t) / 1000 - INTERVAL * 1000)
+		end
+		table.sort(err)
+		skynet.ret(skynet.pack(err[ROUND // 2], err[math.ceil(ROUND * 0.99)]))
+	end)
+end)
+
+else
+
+skynet.start(function()
+	local slave = skynet.newservice(SERVICE_NAME, "slave")
+	local cpu = os.clock()
+	local begin = skynet.hpc()
+	local p50, p99 = skynet.call(slave, "lua")
+	local ti = (skynet.hpc() - begin) / 1000000000
+	cpu = os.clock() - cpu
+	skynet.error(string.format("timer_tick = %s, sleep_ms(%d) error p50 = %.0fus p99 = %.0fus, cpu = %.1f%%",
+		skynet.getenv "timer_tick", INTERVAL, p50, p99, cpu / ti * 100))
+	skynet.exit()
+end)
+
+end
@@ -0,0 +1,36 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+
+-- The datagrams are read by recvmmsg, and delivered to the service in batch (see socket.udp).
+-- udp may drop packages when the receiver is slow, so it reports how many are received.
+
+local PORT = 8766
+local COUNT = 200000
+local BURST = 64
+
+skynet.start(function()
+	local recv = 0
+	local bad = 0
+	local host = socket.udp(function(str, from)
+		recv = recv + 1
+		if #str ~= 16 or not socket.udp_address(from) then
+			bad = bad + 1
+		end
+	end , "127.0.0.1", PORT)
+
+	local c = socket.udp(function() end)
+	socket.udp_connect(c, "127.0.0.1", PORT)
+	local t = skynet.now()
+	local payload = string.rep("x", 16)
+	for i=1,COUNT,BURST do
+		for j=1,BURST do
+			socket.write(c, payload)
+		end
+		skynet.yield()
+	end
+	skynet.sleep(50)
+	t = (skynet.now() - t - 50) / 100
+	print(string.format("send %d, recv %d (bad %d) in %.2fs, %d/s", COUNT, recv, bad, t, math.floor(recv / t)))
+	socket.close(c)
+	socket.close(host)
+end)